@@ -0,0 +1,58 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/lexer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <fmt/format.h>
+
+namespace {
+    /// @brief Representative Firestorm code, with every kind of token
+    constexpr const char *chunk = "define sumsq(n) for i = 0, i < n, 1.5 then i * i + (n - 3) / 2;\n"
+                                  "extern putchard(c);\n"
+                                  "define fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);\n"
+                                  "putchard(fib(10) == 55);\n";
+
+    /// @return Firestorm code of at least size bytes, of whole statements
+    std::string generateInput(std::size_t size) {
+        std::string input;
+        input.reserve(size + 256);
+        while (input.size() < size) input += chunk;
+        return input;
+    }
+}
+
+/// @brief Lexes inputs doubling in size up to a maximum, by default 100 MB, and prints the time per input and the
+/// throughput, which stays flat as long as lexing is linear.
+///
+/// @note Usage: LexerBenchmark [maximum size in MB]
+int main(int argc, char **argv) {
+    std::size_t maxMegabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+    if (maxMegabytes == 0) {
+        std::cerr << "Usage: LexerBenchmark [maximum size in MB]\n";
+        return 1;
+    }
+
+    Firestorm::Lexing::Lexer lexer;
+    std::cout << fmt::format("{:>10} {:>12} {:>10} {:>10}\n", "MB", "tokens", "seconds", "MB/s");
+    for (std::size_t megabytes = 1;; megabytes = std::min(megabytes * 2, maxMegabytes)) {
+        auto input = generateInput(megabytes << 20);
+
+        auto start = std::chrono::steady_clock::now();
+        auto stream = lexer.lex(input);
+        std::size_t tokens = 0;
+        while (stream.getNextToken().type != Firestorm::Lexing::Type::Eof) ++tokens;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        auto size = (double) input.size() / (1 << 20);
+        std::cout << fmt::format("{:>10.1f} {:>12} {:>10.3f} {:>10.1f}\n", size, tokens, elapsed.count(),
+                                 size / elapsed.count());
+        if (megabytes == maxMegabytes) return 0;
+    }
+}
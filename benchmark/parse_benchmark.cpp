@@ -0,0 +1,174 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/ast.hpp"
+#include "Firestorm/lexer.hpp"
+#include "Firestorm/parser.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace {
+    std::atomic<std::size_t> allocations{0};
+}
+
+// Every heap allocation of the process is counted
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+    using Firestorm::AST::ExprId;
+    using Firestorm::AST::ExprKind;
+    using Firestorm::AST::Program;
+
+    /// @brief Node of an AST allocated one node at a time, as the parser did before nodes were allocated in bulk,
+    /// i.e. every node on the heap, owned by its parent, with its children and names in vectors and strings.
+    struct BoxedNode {
+        std::string name;
+        std::vector<std::unique_ptr<BoxedNode>> children;
+        std::vector<std::string> parameters;
+        double value = 0;
+
+        virtual ~BoxedNode() = default;
+    };
+
+    std::unique_ptr<BoxedNode> box(const Program &program, ExprId id) {
+        auto node = std::make_unique<BoxedNode>();
+        switch (id.kind()) {
+            case ExprKind::Number:
+                node->value = program.get<Firestorm::AST::NumberExpr>(id).value;
+                return node;
+            case ExprKind::Variable:
+                node->name = Firestorm::Utility::getSymbolName(program.get<Firestorm::AST::VariableExpr>(id).name);
+                return node;
+            case ExprKind::Binary:
+                // Operators were strings
+                node->name = "+";
+                break;
+            case ExprKind::Call:
+                node->name = Firestorm::Utility::getSymbolName(program.get<Firestorm::AST::CallExpr>(id).callee);
+                break;
+            case ExprKind::For:
+                node->name = Firestorm::Utility::getSymbolName(program.get<Firestorm::AST::ForExpr>(id).varName);
+                break;
+            case ExprKind::Prototype: {
+                const auto &proto = program.get<Firestorm::AST::Prototype>(id);
+                node->name = Firestorm::Utility::getSymbolName(proto.name);
+                for (auto param: program.getArgs(proto)) {
+                    node->parameters.emplace_back(Firestorm::Utility::getSymbolName(param));
+                }
+                return node;
+            }
+            case ExprKind::Function: {
+                const auto &function = program.get<Firestorm::AST::Function>(id);
+                node->children.push_back(box(program, function.proto));
+                node->children.push_back(box(program, function.body));
+                return node;
+            }
+            default:
+                break;
+        }
+        for (std::uint32_t i = 0; i < Firestorm::AST::countChildren(program, id); ++i) {
+            auto child = Firestorm::AST::getChild(program, id, i);
+            node->children.push_back(child ? box(program, child) : nullptr);
+        }
+        return node;
+    }
+
+    /// @brief Representative Firestorm code, with every kind of node
+    constexpr const char *chunk = "define sumsq(n) for i = 0, i < n, 1 then i * i + (n - 3) / 2;\n"
+                                  "extern putchard(c);\n"
+                                  "define fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);\n"
+                                  "putchard(fib(10) == 55);\n";
+
+    struct Measurement {
+        std::size_t allocations = 0;
+        double build = 0, free = 0;
+    };
+
+    template<class Build>
+    Measurement measure(Build &&build) {
+        using Clock = std::chrono::steady_clock;
+        Measurement measurement;
+        auto before = allocations.load();
+        auto start = Clock::now();
+        {
+            auto result = build();
+            auto built = Clock::now();
+            measurement.allocations = allocations.load() - before;
+            measurement.build = std::chrono::duration<double>(built - start).count();
+            start = Clock::now();
+        }
+        measurement.free = std::chrono::duration<double>(Clock::now() - start).count();
+        return measurement;
+    }
+
+    void print(const char *layout, const Measurement &measurement) {
+        std::cout << fmt::format("{:<28} {:>14} {:>12.3f} {:>12.3f}\n", layout, measurement.allocations,
+                                 measurement.build, measurement.free);
+    }
+}
+
+/// @brief Parses generated code into a flat AST::Program and frees it, counting heap allocations and timing both.
+///
+/// @note As a baseline, the same program is also built and freed one heap node at a time, i.e. with the layout the
+/// AST had before nodes were allocated in bulk.
+///
+/// @note Usage: ParseBenchmark [size in MB]
+int main(int argc, char **argv) {
+    std::size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 30;
+    if (megabytes == 0) {
+        std::cerr << "Usage: ParseBenchmark [size in MB]\n";
+        return 1;
+    }
+
+    std::string input;
+    input.reserve((megabytes << 20) + 256);
+    while (input.size() < megabytes << 20) input += chunk;
+
+    Firestorm::Lexing::Lexer lexer;
+    std::cout << fmt::format("{} MB of code\n", input.size() >> 20);
+    std::cout << fmt::format("{:<28} {:>14} {:>12} {:>12}\n", "layout", "allocations", "build (s)", "free (s)");
+
+    // Symbols are interned once for the whole process, so a first parse interns all of them, and keeps the program
+    // for the baseline
+    Program program;
+    {
+        auto stream = lexer.lex(input);
+        program = Firestorm::Parsing::Parser(stream).parse();
+    }
+    auto parse = measure([&] {
+        auto stream = lexer.lex(input);
+        return Firestorm::Parsing::Parser(stream).parse();
+    });
+    print("flat (parse)", parse);
+
+    auto boxed = measure([&] {
+        std::vector<std::unique_ptr<BoxedNode>> statements;
+        for (auto stmt: program.statements) statements.push_back(box(program, stmt));
+        return statements;
+    });
+    print("one node per allocation", boxed);
+    std::cout << "The baseline is built from the parsed program, so its build time does not include parsing\n";
+    return 0;
+}
@@ -0,0 +1,45 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_AOT_HPP
+#define FIRESTORM_AOT_HPP
+
+#include "codegen.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace Firestorm::Backend {
+    /// @return A TargetMachine emitting code for the host, i.e. its triple, CPU and CPU features
+    std::unique_ptr<llvm::TargetMachine> createHostTargetMachine(AST::OptimisationLevel level);
+
+    /// @brief Adds the entry point of an executable to module, i.e. a C main function that runs the given
+    /// functions in order, then returns 0.
+    ///
+    /// @param statements Functions without arguments, wrapping the top-level expressions of a program
+    ///
+    /// @param printMemoStats Whether to print the statistics of memoized functions at the end
+    ///
+    /// @param profile File to write the counters of instrumented functions to at the end, or empty if there are none
+    void addEntryPoint(llvm::Module &module, const std::vector<llvm::Function *> &statements,
+                       bool printMemoStats = false, const std::string &profile = {});
+
+    /// @brief Runs the passes of an Optimiser, tuned for machine.
+    ///
+    /// @param pipeline Pipeline::WholeProgram once module is the complete program, with its entry point
+    void optimiseModule(llvm::Module &module, llvm::TargetMachine &machine, const AST::OptimiserOptions &options,
+                        AST::Pipeline pipeline = AST::Pipeline::Module);
+
+    /// @brief Compiles module to a native object file.
+    void emitObjectFile(llvm::Module &module, llvm::TargetMachine &machine, const std::string &path);
+
+    /// @brief Links an object file with the Firestorm runtime into an executable, using the system C compiler.
+    void linkExecutable(const std::string &object, const std::string &path);
+}
+
+#endif //FIRESTORM_AOT_HPP
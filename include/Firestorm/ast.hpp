@@ -5,149 +5,338 @@
 #ifndef FIRESTORM_AST_HPP
 #define FIRESTORM_AST_HPP
 
-#include "codegen.hpp"
+#include "custom_exceptions.hpp"
+#include "lexer.hpp"
+#include "symbol.hpp"
 
-#include <memory>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 namespace Firestorm::AST {
-    /// @brief Base class for all AST nodes.
-    struct Expr {
-        virtual ~Expr() = default;
+    /// @brief Binary operators. Each has the value of the Lexing::Type of its token.
+    enum class Operator : std::uint8_t {
+        Add = (std::uint8_t) Lexing::Type::Plus,
+        Sub = (std::uint8_t) Lexing::Type::Minus,
+        Mul = (std::uint8_t) Lexing::Type::Times,
+        Div = (std::uint8_t) Lexing::Type::Divide,
+        Equ = (std::uint8_t) Lexing::Type::Equ,
+        Lt = (std::uint8_t) Lexing::Type::Lt,
+    };
 
-        [[nodiscard]]
-        virtual std::string toString() const = 0;
+    enum class Associativity : std::uint8_t {
+        Left,
+        Right,
+    };
 
-        [[nodiscard]]
-        virtual llvm::Value *generateIR() const = 0;
+    /// @brief Describes how a token parses as a binary operator.
+    struct OperatorInfo {
+        /// @brief Binding strength of the operator, or -1 if the token is not a binary operator
+        int precedence = -1;
+        Associativity associativity = Associativity::Left;
+        const char *spelling = "";
     };
 
-    /// @brief Quick using-directive for convenience
-    using ExprPtr = std::unique_ptr<Expr>;
+    /// @return How a token of type parses as a binary operator
+    ///
+    /// @note This is the table of all binary operators. It is a switch over Lexing::Type, which compilers
+    /// lower to a lookup table.
+    constexpr OperatorInfo getOperatorInfo(Lexing::Type type) {
+        switch (type) {
+            case Lexing::Type::Equ:
+                return {100, Associativity::Left, "=="};
+            case Lexing::Type::Lt:
+                return {100, Associativity::Left, "<"};
+
+            case Lexing::Type::Plus:
+                return {200, Associativity::Left, "+"};
+            case Lexing::Type::Minus:
+                return {200, Associativity::Left, "-"};
+            case Lexing::Type::Times:
+                return {300, Associativity::Left, "*"};
+            case Lexing::Type::Divide:
+                return {300, Associativity::Left, "/"};
+
+            default:
+                return {};
+        }
+    }
+
+    constexpr OperatorInfo getOperatorInfo(Operator op) {
+        return getOperatorInfo((Lexing::Type) op);
+    }
+
+    /// @brief Kinds of AST node. Every kind is stored in its own array of Program.
+    enum class ExprKind : std::uint8_t {
+        Number,
+        Variable,
+        Binary,
+        Call,
+        If,
+        For,
+        Prototype,
+        Function,
+    };
 
-    /// @brief Contains a single double-precision floating-point number.
-    struct NumberExpr : public Expr {
-        double value;
+    /// @brief 32-bit handle of an AST node, packing its kind and its index in the array of that kind.
+    ///
+    /// @note The default handle refers to no node, and converts to false.
+    struct ExprId {
+        static constexpr std::uint32_t index_bits = 29;
+        static constexpr std::uint32_t max_index = (std::uint32_t(1) << index_bits) - 1;
 
-        explicit NumberExpr(double v) : value(v) {}
+        std::uint32_t bits = UINT32_MAX;
 
-        [[nodiscard]]
-        std::string toString() const override;
+        ExprId() = default;
+
+        ExprId(ExprKind kind, std::uint32_t index) : bits((std::uint32_t) kind << index_bits | index) {}
 
         [[nodiscard]]
-        llvm::Value *generateIR() const override;
-    };
+        ExprKind kind() const { return (ExprKind) (bits >> index_bits); }
 
-    /// @brief Contains a single named variable.
-    struct VariableExpr : public Expr {
-        std::string name;
+        [[nodiscard]]
+        std::uint32_t index() const { return bits & max_index; }
 
-        explicit VariableExpr(std::string n) : name(std::move(n)) {}
+        explicit operator bool() const { return bits != UINT32_MAX; }
 
-        [[nodiscard]]
-        std::string toString() const override;
+        friend bool operator==(ExprId a, ExprId b) { return a.bits == b.bits; }
 
-        [[nodiscard]]
-        llvm::Value *generateIR() const override;
+        friend bool operator!=(ExprId a, ExprId b) { return a.bits != b.bits; }
     };
 
-    /// @brief Contains a single conditional expression.
-    struct IfExpr : public Expr {
-        ExprPtr condition_clause, then_clause, else_clause;
-
-        IfExpr(ExprPtr c, ExprPtr t, ExprPtr e)
-                : condition_clause(std::move(c)), then_clause(std::move(t)), else_clause(std::move(e)) {}
+    /// @brief View of consecutive children of a node, stored in one of the shared arrays of Program.
+    ///
+    /// @note Adding nodes to the program invalidates the view.
+    template<class T>
+    struct Span {
+        const T *data = nullptr;
+        std::uint32_t length = 0;
 
         [[nodiscard]]
-        std::string toString() const override;
+        const T *begin() const { return data; }
 
         [[nodiscard]]
-        llvm::Value *generateIR() const override;
-    };
+        const T *end() const { return data + length; }
 
-    /// @brief Contains a single for-loop expression.
+        [[nodiscard]]
+        std::uint32_t size() const { return length; }
 
-    struct ForExpr : public Expr {
-        std::string varName;
-        ExprPtr start, end, step, body;
+        [[nodiscard]]
+        bool empty() const { return length == 0; }
 
-        ForExpr(std::string v, ExprPtr s, ExprPtr e, ExprPtr s1, ExprPtr b) : varName(std::move(v)),
-                                                                              start(std::move(s)), end(std::move(e)),
-                                                                              step(std::move(s1)), body(std::move(b)) {}
+        const T &operator[](std::uint32_t i) const { return data[i]; }
+    };
 
-        [[nodiscard]]
-        std::string toString() const override;
+    /// @brief Contains a single double-precision floating-point number.
+    struct NumberExpr {
+        static constexpr auto kind = ExprKind::Number;
 
-        [[nodiscard]]
-        llvm::Value *generateIR() const override;
+        double value;
     };
 
-    /// @brief Contains a single binary expression. Can be nested.
-    struct BinaryExpr : public Expr {
-        ExprPtr lhs;
-        std::string op;
-        ExprPtr rhs;
+    /// @brief Contains a single named variable.
+    struct VariableExpr {
+        static constexpr auto kind = ExprKind::Variable;
 
-        BinaryExpr(ExprPtr l, std::string o, ExprPtr r) : lhs(std::move(l)), op(std::move(o)), rhs(std::move(r)) {}
+        Utility::Symbol name;
+    };
 
-        [[nodiscard]]
-        std::string toString() const override;
+    /// @brief Contains a single binary expression. Can be nested.
+    struct BinaryExpr {
+        static constexpr auto kind = ExprKind::Binary;
 
-        [[nodiscard]]
-        llvm::Value *generateIR() const override;
+        ExprId lhs;
+        Operator op;
+        ExprId rhs;
     };
 
     /// @brief Contains a single function call.
-    struct CallExpr : public Expr {
-        std::string callee;
-        std::vector<ExprPtr> args;
+    ///
+    /// @note Arguments are Program::arguments[firstArg, firstArg + argCount).
+    struct CallExpr {
+        static constexpr auto kind = ExprKind::Call;
 
-        CallExpr(std::string c, std::vector<ExprPtr> a) : callee(std::move(c)), args(std::move(a)) {}
+        Utility::Symbol callee;
+        std::uint32_t firstArg = 0, argCount = 0;
+    };
 
-        [[nodiscard]]
-        std::string toString() const override;
+    /// @brief Contains a single conditional expression.
+    struct IfExpr {
+        static constexpr auto kind = ExprKind::If;
 
-        [[nodiscard]]
-        llvm::Value *generateIR() const override;
+        ExprId condition_clause, then_clause, else_clause;
     };
 
-    /// @brief Contains a single function prototype.
-    struct Prototype : public Expr {
-        std::string name;
-        std::vector<std::string> args;
+    /// @brief Contains a single for-loop expression.
+    ///
+    /// @note step is optional, and refers to no node if omitted.
+    struct ForExpr {
+        static constexpr auto kind = ExprKind::For;
 
-        Prototype(std::string n, std::vector<std::string> a) : name(std::move(n)), args(std::move(a)) {}
+        Utility::Symbol varName;
+        ExprId start, end, step, body;
+    };
 
-        [[nodiscard]]
-        std::string toString() const override;
+    /// @brief Contains a single function prototype.
+    ///
+    /// @note Arguments are Program::parameters[firstArg, firstArg + argCount).
+    struct Prototype {
+        static constexpr auto kind = ExprKind::Prototype;
 
-        [[nodiscard]]
-        llvm::Function *generateIR() const override;
+        Utility::Symbol name;
+        std::uint32_t firstArg = 0, argCount = 0;
     };
 
-    /// @brief Quick using-directive for convenience
-    using ProtoPtr = std::unique_ptr<Prototype>;
+    /// @brief Fast-math flags, which allow optimisations that don't keep IEEE semantics, with the meaning of the
+    /// LLVM flags of the same name. They combine as bits.
+    namespace FastMath {
+        constexpr std::uint8_t Reassoc = 1 << 0;
+        constexpr std::uint8_t NoNaNs = 1 << 1;
+        constexpr std::uint8_t NoInfs = 1 << 2;
+        constexpr std::uint8_t NoSignedZeros = 1 << 3;
+        constexpr std::uint8_t AllowReciprocal = 1 << 4;
+        constexpr std::uint8_t AllowContract = 1 << 5;
+        constexpr std::uint8_t ApproxFunc = 1 << 6;
+        constexpr std::uint8_t Fast = (1 << 7) - 1;
+    }
+
+    /// @return The fast-math flags named by an annotation or an option, i.e. "reassoc", "nnan", "ninf", "nsz",
+    /// "arcp", "contract", "afn", or "fast" for all of them, or 0 if name is none of them
+    std::uint8_t getFastMathFlags(std::string_view name);
 
     /// @brief Contains a single function definition.
-    struct Function : public Expr {
-        ProtoPtr proto;
-        ExprPtr body;
+    struct Function {
+        static constexpr auto kind = ExprKind::Function;
+
+        ExprId proto;
+        ExprId body;
 
-        Function(ProtoPtr p, ExprPtr b) : proto(std::move(p)), body(std::move(b)) {}
+        /// @brief Fast-math flags of its annotations, e.g. 'define fast f(x) ...'
+        std::uint8_t fastMath = 0;
+
+        /// @brief Whether its annotations request memoization, i.e. 'define memo f(x) ...'
+        bool memoize = false;
+    };
+
+    /// @brief Flat AST of a parse. Nodes of each kind live in one contiguous array and refer to their children
+    /// by ExprId, so the whole tree is freed at once and traversals stay within a few arrays.
+    struct Program {
+        std::vector<NumberExpr> numbers;
+        std::vector<VariableExpr> variables;
+        std::vector<BinaryExpr> binaries;
+        std::vector<CallExpr> calls;
+        std::vector<IfExpr> ifs;
+        std::vector<ForExpr> fors;
+        std::vector<Prototype> prototypes;
+        std::vector<Function> functions;
+
+        /// @brief Arguments of all CallExpr
+        std::vector<ExprId> arguments;
+
+        /// @brief Arguments of all Prototype
+        std::vector<Utility::Symbol> parameters;
+
+        /// @brief Top-level statements, i.e. Prototype of externs, Function or any other expression
+        std::vector<ExprId> statements;
+
+        /// @return The array storing nodes of type Node
+        template<class Node>
+        std::vector<Node> &nodes() {
+            if constexpr (Node::kind == ExprKind::Number) return numbers;
+            else if constexpr (Node::kind == ExprKind::Variable) return variables;
+            else if constexpr (Node::kind == ExprKind::Binary) return binaries;
+            else if constexpr (Node::kind == ExprKind::Call) return calls;
+            else if constexpr (Node::kind == ExprKind::If) return ifs;
+            else if constexpr (Node::kind == ExprKind::For) return fors;
+            else if constexpr (Node::kind == ExprKind::Prototype) return prototypes;
+            else return functions;
+        }
+
+        template<class Node>
+        const std::vector<Node> &nodes() const { return const_cast<Program *>(this)->nodes<Node>(); }
+
+        /// @brief Adds a node to the program.
+        ///
+        /// @return The handle of the added node
+        template<class Node>
+        ExprId add(Node node) {
+            auto &array = nodes<Node>();
+            if (array.size() > ExprId::max_index) {
+                throw Utility::getError(Utility::FE, "Too many nodes in program");
+            }
+            array.push_back(std::move(node));
+            return {Node::kind, (std::uint32_t) array.size() - 1};
+        }
+
+        /// @return The node referred to by id, which must be of type Node
+        template<class Node>
+        const Node &get(ExprId id) const { return nodes<Node>()[id.index()]; }
+
+        template<class Node>
+        Node &get(ExprId id) { return nodes<Node>()[id.index()]; }
 
         [[nodiscard]]
-        std::string toString() const override;
+        Span<ExprId> getArgs(const CallExpr &call) const {
+            return {arguments.data() + call.firstArg, call.argCount};
+        }
 
         [[nodiscard]]
-        llvm::Value *generateIR() const override;
-    };
+        Span<Utility::Symbol> getArgs(const Prototype &proto) const {
+            return {parameters.data() + proto.firstArg, proto.argCount};
+        }
 
-    /// @brief Quick using-directive for convenience
-    using FunctionPtr = std::unique_ptr<Function>;
+        /// @brief Removes all nodes, keeping the memory of the arrays for the next parse.
+        void clear();
+    };
 
-    /// @return Get an instance of CodeGenerator
-    CodeGenerator &getCodegen();
+    /// @brief Calls visitor with the node referred to by id.
+    ///
+    /// @tparam P Program or const Program
+    ///
+    /// @tparam Visitor Callable with every node type, returning the same type for all of them
+    ///
+    /// @return What visitor returns
+    template<class P, class Visitor>
+    decltype(auto) visit(P &program, ExprId id, Visitor &&visitor) {
+        switch (id.kind()) {
+            case ExprKind::Number:
+                return visitor(program.numbers[id.index()]);
+            case ExprKind::Variable:
+                return visitor(program.variables[id.index()]);
+            case ExprKind::Binary:
+                return visitor(program.binaries[id.index()]);
+            case ExprKind::Call:
+                return visitor(program.calls[id.index()]);
+            case ExprKind::If:
+                return visitor(program.ifs[id.index()]);
+            case ExprKind::For:
+                return visitor(program.fors[id.index()]);
+            case ExprKind::Prototype:
+                return visitor(program.prototypes[id.index()]);
+            case ExprKind::Function:
+                return visitor(program.functions[id.index()]);
+        }
+        throw Utility::getError(Utility::FE, "Invalid AST node");
+    }
+
+    /// @return The number of children of an expression, including an omitted step of for-loops
+    ///
+    /// @note Prototypes and functions have none, as they are not expressions.
+    std::uint32_t countChildren(const Program &program, ExprId id);
+
+    /// @return The i-th child of an expression, which refers to no node for an omitted step
+    ExprId &getChild(Program &program, ExprId id, std::uint32_t i);
+
+    ExprId getChild(const Program &program, ExprId id, std::uint32_t i);
+
+    /// @brief Copies the node referred to by id, and all the nodes under it, from one program into another.
+    ///
+    /// @return The copy in to
+    ExprId copyTree(Program &to, const Program &from, ExprId id);
+
+    /// @return String representation of the node referred to by id
+    std::string toString(const Program &program, ExprId id);
 }
 #endif //FIRESTORM_AST_HPP
@@ -0,0 +1,70 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_AST_OPTIMISER_HPP
+#define FIRESTORM_AST_OPTIMISER_HPP
+
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "optimiser.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace Firestorm::AST {
+    /// @brief A rewrite of a node, called once its children are rewritten.
+    ///
+    /// @note A rule may add nodes to program, which invalidates references to its nodes.
+    ///
+    /// @return The node to replace it with, or the node itself
+    using ASTRule = std::function<ExprId(Program &program, ExprId id)>;
+
+    /// @brief Simplifies the AST of a statement before code is generated for it, so that less IR is built and
+    /// optimised by LLVM.
+    ///
+    /// @note Nodes are rewritten bottom-up in a single walk without recursion, every node by each rule in order,
+    /// so that simplifications of children enable those of their parents. Replaced nodes stay in program,
+    /// unreachable.
+    ///
+    /// @note Rewrites keep the values of IEEE doubles exactly, including NaN and the sign of zero, as no
+    /// fast-math is assumed. Errors in removed code, e.g. calls to unknown functions in dead branches, are not
+    /// reported any more.
+    struct ASTOptimiser {
+        std::vector<ASTRule> rules;
+
+        /// @brief Pure functions defined so far, whose calls with constant arguments are replaced by their value
+        PartialEvaluator evaluator;
+
+        /// @brief Builds the default rules of a level, which are none at O0.
+        ///
+        /// @param limits Bounds of evaluating a call at compile time
+        explicit ASTOptimiser(OptimisationLevel level, EvaluationLimits limits = {});
+
+        /// @note Rules refer to evaluator.
+        ASTOptimiser(const ASTOptimiser &) = delete;
+
+        void operator=(const ASTOptimiser &) = delete;
+
+        /// @brief Rewrites the body of definitions and top-level expressions, then records definitions and externs
+        /// in evaluator.
+        ///
+        /// @return The statement to compile instead of stmt
+        ExprId run(Program &program, ExprId stmt);
+    };
+
+    /// @brief Replaces binary operators of two numbers by their value.
+    ExprId foldConstants(Program &program, ExprId id);
+
+    /// @brief Replaces x * 1, 1 * x, x / 1, x - 0, x + -0 and -0 + x by x.
+    ExprId simplifyIdentities(Program &program, ExprId id);
+
+    /// @brief Replaces conditionals whose condition is a number by the branch taken.
+    ExprId eliminateDeadBranches(Program &program, ExprId id);
+
+    /// @brief Replaces the bodies of for-loops by 0 if they call no function and contain no loop, as their
+    /// value is not used.
+    ExprId dropUnusedValues(Program &program, ExprId id);
+}
+
+#endif //FIRESTORM_AST_OPTIMISER_HPP
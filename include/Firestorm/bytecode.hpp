@@ -0,0 +1,90 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_BYTECODE_HPP
+#define FIRESTORM_BYTECODE_HPP
+
+#include "ast.hpp"
+#include "symbol.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace Firestorm::Backend {
+    /// @brief Every opcode of the bytecode, as X(name), in the order of Opcode.
+    ///
+    /// @note a, b and c are registers, and wide() is a constant, an instruction or a function.
+    #define FIRESTORM_OPCODES(X) \
+        X(LoadConst)   /* a = constants[wide()]                                   */ \
+        X(Move)        /* a = b                                                   */ \
+        X(Add)         /* a = b + c                                               */ \
+        X(Sub)         /* a = b - c                                               */ \
+        X(Mul)         /* a = b * c                                               */ \
+        X(Div)         /* a = b / c                                               */ \
+        X(Equ)         /* a = b == c                                              */ \
+        X(Lt)          /* a = b < c, or 1 if either is NaN                        */ \
+        X(Jump)        /* go to code[wide()]                                      */ \
+        X(JumpIfFalse) /* go to code[wide()] if a is 0 or NaN                     */ \
+        X(JumpIfTrue)  /* go to code[wide()] if a is neither 0 nor NaN            */ \
+        X(Call)        /* a = functions[wide()](a, a + 1, ...), the callee's frame starting at a */ \
+        X(TailCall)    /* return functions[wide()](a, a + 1, ...), in the frame of the caller */ \
+        X(Return)      /* return a                                                */
+
+    enum class Opcode : std::uint8_t {
+#define FIRESTORM_OPCODE(name) name,
+        FIRESTORM_OPCODES(FIRESTORM_OPCODE)
+#undef FIRESTORM_OPCODE
+    };
+
+    /// @brief A fixed-size, 8-byte instruction of a register machine.
+    struct Instruction {
+        Opcode op;
+        std::uint16_t a = 0, b = 0, c = 0;
+
+        /// @return b and c as a single 32-bit operand
+        [[nodiscard]]
+        std::uint32_t wide() const { return b | (std::uint32_t) c << 16; }
+
+        static Instruction withWide(Opcode op, std::uint16_t a, std::uint32_t wide) {
+            return {op, a, (std::uint16_t) wide, (std::uint16_t) (wide >> 16)};
+        }
+    };
+
+    /// @brief A function, compiled to bytecode or declared with extern.
+    ///
+    /// @note Arguments are passed in the first registers of a function, and it returns in its first register.
+    struct BytecodeFunction {
+        Utility::Symbol name;
+        std::uint32_t arity = 0;
+
+        /// @brief Number of registers of a call, including the arguments
+        std::uint32_t registerCount = 0;
+
+        /// @brief The code, which is empty for externs
+        std::vector<Instruction> code;
+        std::vector<double> constants;
+
+        /// @brief Native code of an extern, looked up when it is first called
+        void *native = nullptr;
+    };
+
+    /// @brief Functions declared so far, which calls refer to by index.
+    struct BytecodeModule {
+        std::vector<BytecodeFunction> functions;
+        std::unordered_map<Utility::Symbol, std::uint32_t> indices;
+    };
+
+    /// @brief Compiles a statement to bytecode, without recursion.
+    ///
+    /// @note Externs and definitions are added to module. Like with LLVM IR, a function can call those declared
+    /// before it, and externs that are never defined are looked up in the process when they are first called.
+    ///
+    /// @return A function without arguments for a top-level expression, or nothing for externs and definitions
+    std::optional<BytecodeFunction> compileBytecode(BytecodeModule &module, const AST::Program &program,
+                                                    AST::ExprId stmt);
+}
+
+#endif //FIRESTORM_BYTECODE_HPP
@@ -0,0 +1,76 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_CACHE_HPP
+#define FIRESTORM_CACHE_HPP
+
+#include "ast.hpp"
+#include "optimiser.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace Firestorm::Backend {
+    /// @brief Content-addressed cache of compiled code in a directory, shared by every process that uses it.
+    ///
+    /// @note The key of a function hashes its AST, the keys of the functions it calls, the options it is compiled
+    /// with and the host target, so that an entry never has to be invalidated: a changed function, or one calling
+    /// a changed function, simply gets another key. Entries are written to a temporary file that is then renamed,
+    /// so that concurrent processes never read partial entries.
+    ///
+    /// @note Custom passes of OptimiserOptions::extensions cannot be hashed, so code compiled with them must not be
+    /// cached.
+    ///
+    /// @note As an llvm::ObjectCache of the JIT, it stores and loads the object files of modules marked with
+    /// setKey(), and ignores other ones.
+    class CompileCache : public llvm::ObjectCache {
+        std::string directory;
+
+        /// @brief Hash of the options and the target, which every key starts with
+        std::string base;
+
+        /// @brief Profile that functions are optimised with, whose counters are part of their keys, or nullptr
+        std::shared_ptr<const AST::Profile> profile;
+
+        /// @brief Keys of the functions defined so far, to hash into the keys of their callers
+        std::unordered_map<Utility::Symbol, std::string> functions;
+
+        std::string getPath(llvm::StringRef key, llvm::StringRef extension) const;
+
+    public:
+        /// @param directory Directory of the cache, which is created if needed
+        ///
+        /// @param options Passes that code is compiled with
+        CompileCache(std::string directory, const AST::OptimiserOptions &options);
+
+        /// @return The key of a statement of program, which is remembered for the callers of definitions
+        std::string getKey(const AST::Program &program, AST::ExprId stmt);
+
+        /// @return The key of a whole program, i.e. of the keys of its statements in order, and of the options of
+        /// its entry point
+        std::string getProgramKey(const std::vector<std::string> &statements, llvm::StringRef entryPoint) const;
+
+        /// @return The entry of key with the given extension, or nullptr if there is none
+        std::unique_ptr<llvm::MemoryBuffer> load(llvm::StringRef key, llvm::StringRef extension) const;
+
+        /// @brief Stores the entry of key with the given extension, ignoring failures, as the cache is optional.
+        void store(llvm::StringRef key, llvm::StringRef extension, llvm::StringRef data) const;
+
+        /// @brief Marks module as the code of key, so that its object file is cached.
+        static void setKey(llvm::Module &module, llvm::StringRef key);
+
+        void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override;
+
+        std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override;
+    };
+}
+
+#endif //FIRESTORM_CACHE_HPP
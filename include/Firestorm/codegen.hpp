@@ -4,33 +4,77 @@
 #ifndef FIRESTORM_CODEGEN_HPP
 #define FIRESTORM_CODEGEN_HPP
 
-#include <map>
+#include "ast.hpp"
+#include "optimiser.hpp"
+#include "symbol.hpp"
+
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 
 namespace Firestorm::AST {
-    /// @brief Contains LLVM's optimisation passes to run when compiling Firestorm code.
-    struct Optimiser {
-        llvm::legacy::FunctionPassManager passManager;
+    /// @brief Signature of a function declared in any module of a CodeGenerator.
+    struct FunctionSignature {
+        std::vector<Utility::Symbol> parameters;
+
+        /// @brief Whether the function has a body in some module
+        bool defined = false;
 
-        explicit Optimiser(llvm::Module &m);
+        /// @brief Whether the function only computes a value of its arguments, i.e. it is defined, and only calls
+        /// itself and pure functions, but no extern
+        bool pure = false;
     };
 
     /// @brief Contains LLVM elements used to emit LLVM IR for Firestorm code.
+    ///
+    /// @note IR is emitted into the current module, which can be handed over with takeModule(), e.g. to the JIT.
+    /// Functions of earlier modules stay callable, as they are declared again in the module that calls them.
+    ///
+    /// @note Calls to functions of earlier modules cannot be inlined as such, so takeModule() keeps the bitcode of
+    /// small optimised functions, and imports it into later modules that call them as available_externally
+    /// definitions. The inliner can use those, while the code of the function itself stays in its own module.
+    ///
+    /// @note A CodeGenerator is a compilation session, and shares no state with other ones, so independent
+    /// programs can be compiled concurrently by one session per thread. A session must not be used by two
+    /// threads at once.
     struct CodeGenerator {
-        llvm::LLVMContext context;
-        llvm::IRBuilder<> builder;
-        llvm::Module module;
-        Optimiser optimiser;
-        std::map<std::string, llvm::Value *> namedValues;
+        std::unique_ptr<llvm::LLVMContext> context;
+        std::unique_ptr<llvm::IRBuilder<>> builder;
+        std::unique_ptr<llvm::Module> module;
+        std::unique_ptr<Optimiser> optimiser;
+        std::unordered_map<Utility::Symbol, llvm::Value *> namedValues;
+
+        /// @brief Functions declared in module, so that calls don't look them up by name
+        std::unordered_map<Utility::Symbol, llvm::Function *> functions;
+
+        /// @brief Functions declared in all modules so far
+        std::unordered_map<Utility::Symbol, FunctionSignature> signatures;
+
+        /// @brief Fast-math flags of all functions, from OptimiserOptions::fastMath
+        std::uint8_t fastMath = 0;
+
+        /// @brief Memoization of functions, from OptimiserOptions::memo
+        MemoOptions memo;
+
+        /// @brief Instrumentation of functions, and the profile they are optimised with, from
+        /// OptimiserOptions::profile
+        ProfileOptions profile;
+
+        /// @brief Whether bodies of functions are imported into later modules, i.e. unless they are not optimised
+        bool inlineAcrossModules = false;
 
-        CodeGenerator();
+        /// @brief Bitcode of the functions of earlier modules that are small enough to import
+        std::unordered_map<Utility::Symbol, llvm::SmallVector<char, 0>> inlineableBodies;
+
+        /// @param options Passes to optimise generated code with
+        explicit CodeGenerator(const OptimiserOptions &options = {});
 
         CodeGenerator(const CodeGenerator &) = delete;
 
@@ -39,6 +83,39 @@ namespace Firestorm::AST {
         void operator=(const CodeGenerator &) = delete;
 
         void operator=(CodeGenerator &&) = delete;
+
+        /// @brief Starts emitting IR into a new module, with its own context.
+        ///
+        /// @param name Name of the module
+        void startModule(const std::string &name);
+
+        /// @brief Imports the bodies of functions it calls into the current module, and runs the module passes of
+        /// the optimiser on it, then hands it over together with its context, and starts a new one.
+        ///
+        /// @return The module emitted so far
+        llvm::orc::ThreadSafeModule takeModule();
+
+        /// @brief Replaces the optimiser of generated code, and the fast-math flags, memoization and profiling of
+        /// later functions.
+        void setOptimiserOptions(const OptimiserOptions &options);
+
+        /// @return The function declared in module as name, declaring it if it was declared in an earlier
+        /// module, or nullptr if it was never declared
+        llvm::Function *getFunction(Utility::Symbol name);
     };
+
+    /// @return Whether a definition only calls itself and functions that codegen knows to be pure
+    bool isPureFunction(const CodeGenerator &codegen, const Program &program, ExprId function);
+
+    /// @brief Emits LLVM IR for a node into the current module of codegen.
+    ///
+    /// @param codegen The compilation session to emit IR in
+    ///
+    /// @param program The program containing the node
+    ///
+    /// @param id The node to emit IR for
+    ///
+    /// @return The emitted value, which is a llvm::Function for prototypes and functions
+    llvm::Value *generateIR(CodeGenerator &codegen, const Program &program, ExprId id);
 }
 #endif //FIRESTORM_CODEGEN_HPP
@@ -38,11 +38,20 @@ namespace Firestorm::Utility {
         explicit CodegenError(const std::string &msg);
     };
 
+    /// @brief Subclass of FirestormError. Thrown when an error occurred while compiling LLVM IR to native code or
+    /// running it.
+    ///
+    /// @note This exception is not to be thrown directly. Use getError() instead.
+    struct BackendError : FirestormError {
+        explicit BackendError(const std::string &msg);
+    };
+
     enum ErrorType {
         FE, // FirestormError
         LE, // LexerError
         PE, // ParserError
         CE, // CodegenError
+        BE, // BackendError
     };
 
     /// @brief Get an instance of FirestormError or its subclasses with a message and arguments
@@ -68,6 +77,8 @@ namespace Firestorm::Utility {
                 return ParserError(msg);
             case CE:
                 return CodegenError(msg);
+            case BE:
+                return BackendError(msg);
         }
     }
 }
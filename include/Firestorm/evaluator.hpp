@@ -0,0 +1,59 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_EVALUATOR_HPP
+#define FIRESTORM_EVALUATOR_HPP
+
+#include "ast.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+namespace Firestorm::AST {
+    /// @brief Bounds the work of evaluating a call at compile time, so that compilation always terminates.
+    struct EvaluationLimits {
+        /// @brief Number of nodes evaluated per call at most, or 0 to never evaluate calls
+        std::uint64_t fuel = 1'000'000;
+
+        /// @brief Depth of nested calls at most
+        std::uint32_t depth = 10'000;
+    };
+
+    /// @brief Evaluates calls of pure functions with constant arguments at compile time.
+    ///
+    /// @note A function is pure if it only calls itself and pure functions defined before it, so it only computes
+    /// with doubles, and never reaches an extern. Definitions are recorded one statement at a time, keeping a copy
+    /// of the bodies of pure functions, as statements are freed once they are compiled.
+    class PartialEvaluator {
+        /// @brief Bodies of pure functions, which outlive the statements they were defined in
+        Program library;
+
+        /// @brief Functions and externs by name, referring to their Function in library if they are pure, or to
+        /// no node otherwise
+        std::unordered_map<Utility::Symbol, ExprId> functions;
+
+        /// @return Whether the body of function only calls pure functions, and only uses variables in scope,
+        /// so that its code generation can't fail either
+        bool isPure(const Program &program, const Function &function) const;
+
+    public:
+        EvaluationLimits limits;
+
+        explicit PartialEvaluator(EvaluationLimits limits = {}) : limits(limits) {}
+
+        /// @brief Records a definition, or an extern as a function that is not pure. Later declarations of a name
+        /// are ignored, as only its first declaration compiles.
+        void declare(const Program &program, ExprId stmt);
+
+        /// @return The value of a call of a pure function with numbers as arguments, or nothing if it can't be
+        /// evaluated within limits
+        std::optional<double> evaluate(const Program &program, const CallExpr &call) const;
+
+        /// @brief Replaces a call by its value, if it can be evaluated.
+        ExprId fold(Program &program, ExprId id) const;
+    };
+}
+
+#endif //FIRESTORM_EVALUATOR_HPP
@@ -5,10 +5,71 @@
 #ifndef FIRESTORM_FRONTEND_HPP
 #define FIRESTORM_FRONTEND_HPP
 
+#include "codegen.hpp"
+#include "evaluator.hpp"
+
+#include <string>
+
 namespace Firestorm::Frontend {
+    /// @brief Options of the command line.
+    struct Options {
+        std::string input;
+
+        /// @brief Path of the output. If empty, it is input with extension .o for object files, or a.out
+        std::string output;
+
+        /// @brief Whether to only emit an object file, instead of linking an executable
+        bool objectOnly = false;
+
+        AST::OptimiserOptions optimiser;
+
+        /// @brief Bounds of evaluating calls of pure functions with constant arguments at compile time
+        AST::EvaluationLimits evaluation;
+
+        /// @brief Number of threads generating and optimising the functions of a file, or 0 for one per core.
+        /// With 1, functions are generated one at a time, and optimised together with the rest of the program.
+        unsigned jobs = 1;
+
+        /// @brief Whether the JIT runs functions unoptimised first, and recompiles hot ones at -O3 in the background
+        bool tiered = false;
+
+        /// @brief Whether files and the REPL run on the bytecode VM instead of the JIT, which starts faster
+        bool vm = false;
+
+        /// @brief Whether the JIT keeps the AST of definitions, and only generates and compiles them when they are
+        /// first called, so that startup time scales with the functions that are used
+        bool lazy = false;
+
+        /// @brief Directory of the compiled code of functions, or of whole executables, kept across runs, or empty
+        /// if code is not cached. The JIT does not cache tiered functions.
+        std::string cacheDirectory;
+    };
+
     class Interpreter {
     public:
-        static void run();
+        /// @brief Starts the REPL, which compiles every input to native code, or to bytecode with options.vm, and
+        /// runs it.
+        static void run(const Options &options);
+
+        /// @brief Runs options.input statement by statement, streaming it from disk.
+        ///
+        /// @return Whether the file compiled and ran without errors
+        static bool runFile(const Options &options);
+    };
+
+    class Compiler {
+    public:
+        /// @brief Compiles options.input ahead of time to native code, streaming it from disk.
+        ///
+        /// @note Top-level expressions run in order when the executable starts, from a generated C main function.
+        ///
+        /// @return Whether the file compiled and linked without errors
+        static bool compile(const Options &options);
+
+        /// @brief Compiles options.input statement by statement, streaming it from disk, then prints its LLVM IR.
+        ///
+        /// @return Whether the file compiled without errors
+        static bool emitIR(const Options &options);
     };
 }
 
@@ -0,0 +1,170 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_JIT_HPP
+#define FIRESTORM_JIT_HPP
+
+#include "optimiser.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace Firestorm::Backend {
+    /// @brief Registers the native target with LLVM, once per process.
+    ///
+    /// @note Safe to call from any number of threads, e.g. by every compilation session.
+    void initialiseNativeTarget();
+
+    /// @brief Configures tiered compilation of the functions of a JIT.
+    struct TieringOptions {
+        /// @brief Passes to recompile hot functions with
+        AST::OptimiserOptions optimiser{AST::OptimisationLevel::O3};
+
+        /// @brief Number of calls after which a function is hot
+        std::uint64_t threshold = 1000;
+    };
+
+    /// @brief Compiles modules to native code in memory and runs them, on top of ORC LLJIT.
+    ///
+    /// @note Functions of every added module can be called by modules added later, together with those of the
+    /// Firestorm runtime and of the process, e.g. the C math library.
+    ///
+    /// @note With tiering, functions are expected to be added quickly optimised, e.g. at -O0. Each one then
+    /// counts its calls, and is recompiled with the passes of TieringOptions on a background thread once it is
+    /// hot. Callers reach functions through a stub, whose target is swapped atomically to the recompiled code.
+    ///
+    /// @note Lazy functions are only generated and compiled when they are first called, on the thread that calls
+    /// them. Callers reach them through a lazy re-export, i.e. a stub that calls through ORC's lazy call-through
+    /// manager, which materialises the function in a library of its own and points the stub to its code.
+    class JIT {
+    public:
+        /// @brief Generates the module of a lazy function, defining the function under its name
+        using FunctionGenerator = std::function<llvm::orc::ThreadSafeModule()>;
+
+    private:
+        /// @brief A function added with tiering
+        struct TieredFunction {
+            JIT *jit;
+            std::string name;
+
+            /// @brief The module of the function as it was added, to recompile it from
+            llvm::SmallVector<char, 0> bitcode;
+        };
+
+        /// @brief Whether the session reported an error, e.g. of a lazy function that failed to generate
+        std::atomic<bool> failed{false};
+
+        std::unique_ptr<llvm::orc::LLJIT> jit;
+        std::optional<TieringOptions> tiering;
+
+        /// @brief Stubs of tiered functions, and lazy re-exports
+        std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+
+        /// @brief Library that lazy functions are materialised in, created with the first of them
+        llvm::orc::JITDylib *lazyLibrary = nullptr;
+        std::unique_ptr<llvm::orc::LazyCallThroughManager> callThrough;
+
+        /// @brief Functions added with tiering, which never move, as their code refers to them
+        std::deque<TieredFunction> functions;
+
+        std::mutex mutex;
+        std::condition_variable hot;
+        std::deque<TieredFunction *> hotFunctions;
+        bool stopping = false;
+        std::thread recompiler;
+
+        /// @brief Called by the code of a TieredFunction when it becomes hot, which queues it for recompilation.
+        static void onHot(void *function);
+
+        /// @brief Recompiles hot functions until the JIT is destroyed.
+        void recompileHotFunctions();
+
+        void addTieredFunction(llvm::orc::ThreadSafeModule module);
+
+        /// @brief Calls a function that takes no arguments, then removes the code of tracker.
+        double call(const llvm::orc::ResourceTrackerSP &tracker, const std::string &name);
+
+    public:
+        /// @param tiering How to recompile hot functions, or nothing to compile every function once
+        ///
+        /// @param cache Cache of the object files of compiled modules, or nullptr. It is not used with tiering, as
+        /// the code of the first tier refers to this process by address.
+        explicit JIT(std::optional<TieringOptions> tiering = std::nullopt, llvm::ObjectCache *cache = nullptr);
+
+        ~JIT();
+
+        JIT(const JIT &) = delete;
+
+        void operator=(const JIT &) = delete;
+
+        /// @brief Adds a module defining a single function, e.g. a Firestorm definition, which is compiled with
+        /// tiering if it is enabled.
+        ///
+        /// @param module The module, and the context it was created in
+        void addFunction(llvm::orc::ThreadSafeModule module);
+
+        /// @brief Adds a function whose module is only generated and compiled when it is first called, e.g. a
+        /// Firestorm definition of which only the AST is kept.
+        ///
+        /// @note If generate throws a FirestormError, the error is reported, hasFailed() becomes true, and every
+        /// call of the function returns NaN.
+        ///
+        /// @param name Name of the function
+        ///
+        /// @param generate Called once, on the first call of the function
+        void addLazyFunction(const std::string &name, FunctionGenerator generate);
+
+        /// @brief Adds a module, whose functions are compiled when first looked up.
+        ///
+        /// @param module The module, and the context it was created in
+        ///
+        /// @return Tracker of the code of the module, which removes it from the JIT when its remove() is called
+        llvm::orc::ResourceTrackerSP addModule(llvm::orc::ThreadSafeModule module);
+
+        /// @brief Adds an object file compiled by an earlier JIT, e.g. from the cache of a module defining a single
+        /// function, which is linked when one of its functions is first looked up.
+        void addObject(std::unique_ptr<llvm::MemoryBuffer> object);
+
+        /// @return The address of the native code of a function, compiling it if needed
+        void *lookup(const std::string &name);
+
+        /// @brief Adds a module, calls one of its functions that takes no arguments, e.g. one wrapping a top-level
+        /// expression, then removes the module.
+        ///
+        /// @param module The module, and the context it was created in
+        ///
+        /// @param name Name of the function
+        ///
+        /// @return The value returned by the function
+        double evaluate(llvm::orc::ThreadSafeModule module, const std::string &name);
+
+        /// @brief Adds an object file compiled by an earlier JIT, calls one of its functions that takes no
+        /// arguments, then removes it.
+        double evaluate(std::unique_ptr<llvm::MemoryBuffer> object, const std::string &name);
+
+        /// @return Whether an error was reported while running code, e.g. by a lazy function that failed to
+        /// generate or compile when it was called
+        bool hasFailed() const {
+            return failed;
+        }
+    };
+}
+
+#endif //FIRESTORM_JIT_HPP
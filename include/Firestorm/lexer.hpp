@@ -5,11 +5,14 @@
 #define FIRESTORM_LEXER_HPP
 
 #include "custom_exceptions.hpp"
+#include "scan.hpp"
+#include "source.hpp"
+#include "symbol.hpp"
 
 #include <fmt/format.h>
-#include <regex>
+#include <cstddef>
 #include <string>
-#include <utility>
+#include <string_view>
 #include <vector>
 
 namespace Firestorm::Lexing {
@@ -37,20 +40,30 @@ namespace Firestorm::Lexing {
         Id,
     };
 
-    /// @brief Stores source position of the first character in each token.
+    /// @brief Stores source position of a character, as resolved by TokenStream::getPosition().
     struct SourcePosition {
         long index = -1, lineno = -1, colno = -1;
     };
 
-    /// Creates lexing rule sets for Firestorm's lexer.
-    /// @return The regular expression ruleset for Firestorm
-    const std::vector<std::pair<Type, std::regex>> &getRuleSet();
+    /// @brief Looks up a keyword using a perfect hash over its first character, last character and length.
+    ///
+    /// @param word The candidate keyword
+    ///
+    /// @param length The length of word
+    ///
+    /// @return The keyword's type, or Type::Id if word is not a keyword
+    Type getKeywordType(const char *word, std::size_t length);
 
     /// @brief Consists of a single token extracted from source.
+    ///
+    /// @note value is a view into the source, which must outlive the token.
     struct Token {
         Type type{Type::Eof};
-        std::string value;
-        SourcePosition position{};
+        std::string_view value;
+        long index = -1;
+
+        /// @brief Interned name of identifiers. Other tokens have the default symbol.
+        Utility::Symbol symbol{};
 
         /// @return String representation of Token
         [[nodiscard]]
@@ -66,30 +79,49 @@ namespace Firestorm::Lexing {
     /// @brief Can be used to retrieve tokens one-by-one from source;
     struct TokenStream {
         const Lexer &lexer;
-        const std::string &source;
-        long index = 0, lineno = 1, colno = 1;
+        const ScanKernels &kernels;
+        std::string_view source;
+        long index = 0;
         Token currentToken;
 
-        TokenStream(const Lexer &l, const std::string &s) : lexer(l), source(s) { updateSourcePos(); }
+        TokenStream(const Lexer &l, std::string_view s) : lexer(l), kernels(getScanKernels()), source(s) {
+            skipWhitespaces();
+        }
 
         /// @return Next token in source
         Token getNextToken();
 
+        /// @brief Resolves line and column number of a character in source.
+        ///
+        /// @note The line table is built on the first call, so this is meant for diagnostics only.
+        ///
+        /// @param i Index of the character
+        ///
+        /// @return Source position of the character
+        [[nodiscard]]
+        SourcePosition getPosition(long i) const;
+
     private:
-        /// @brief Updates index, line number and column number to the next character in source.
-        void updateSourcePos();
+        /// @brief Start index of every line in source, built lazily by getPosition().
+        mutable std::vector<long> lineOffsets;
+
+        /// @brief Advances index to the next character in source that is not a whitespace, i.e. \s.
+        void skipWhitespaces();
     };
 
-    /// @brief Represents the rule set of Firestorm and acts as a wrapper of TokenStream
+    /// @brief Acts as a wrapper of TokenStream
+    ///
+    /// @note The rule set of Firestorm is hard-coded into TokenStream::getNextToken() as a single-pass scanner.
     struct Lexer {
-        const std::vector<std::pair<Type, std::regex>> &rules;
-
-        Lexer() : rules(getRuleSet()) {}
-
         /// \param input Firestorm source to be parsed
         /// \return An instance of TokenStream
         [[nodiscard]]
-        inline TokenStream lex(const std::string &input) const { return {*this, input}; }
+        inline TokenStream lex(std::string_view input) const { return {*this, input}; }
+
+        /// \param input Firestorm source to be parsed, which is scanned in place
+        /// \return An instance of TokenStream
+        [[nodiscard]]
+        inline TokenStream lex(const Source &input) const { return {*this, input.view()}; }
     };
 }
 #endif //FIRESTORM_LEXER_HPP
@@ -0,0 +1,117 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_OPTIMISER_HPP
+#define FIRESTORM_OPTIMISER_HPP
+
+#include "profile.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace Firestorm::AST {
+    /// @brief How much compile time to spend optimising code, like the -O options of C compilers.
+    enum class OptimisationLevel {
+        O0,
+        O1,
+        O2,
+        O3,
+        Os,
+    };
+
+    /// @brief Configures the memoization of functions by code generation.
+    struct MemoOptions {
+        /// @brief Whether pure functions with more than one recursive call are memoized, besides those annotated
+        /// with 'memo'
+        bool automatic = false;
+
+        /// @brief Size of the cache of every memoized function in bytes at most
+        std::uint64_t budget = 64 * 1024;
+
+        /// @brief Whether memoized functions count their cache hits and misses, to print them when the program
+        /// ends
+        bool stats = false;
+    };
+
+    /// @brief Configures profile-guided optimisation by code generation.
+    struct ProfileOptions {
+        /// @brief File that functions count their calls and branches into when the program ends, or empty if they
+        /// are not instrumented
+        std::string generate;
+
+        /// @brief Profile of an instrumented run, whose counts become branch weights, entry counts and hot or cold
+        /// attributes, or nullptr
+        std::shared_ptr<const Profile> use;
+    };
+
+    /// @brief Configures the passes of an Optimiser.
+    struct OptimiserOptions {
+        OptimisationLevel level = OptimisationLevel::O2;
+
+        /// @brief Module passes to run after those of level, in the syntax of 'opt -passes', e.g. "instcombine,gvn"
+        std::string extraPasses;
+
+        /// @brief Fast-math flags of AST::FastMath set on the floating-point operations of all functions, besides
+        /// those of their annotations
+        std::uint8_t fastMath = 0;
+
+        MemoOptions memo;
+
+        ProfileOptions profile;
+
+        /// @brief Called with the PassBuilder of every Optimiser before its pipelines are built, e.g. to add custom
+        /// passes at its extension points with PassBuilder::register*EPCallback()
+        std::vector<std::function<void(llvm::PassBuilder &)>> extensions;
+    };
+
+    /// @brief Which code the passes of an Optimiser run on.
+    enum class Pipeline {
+        /// @brief A module as soon as it is complete, whose functions may be called by other modules
+        Module,
+
+        /// @brief A whole program once all of its modules are linked, like link-time optimisation
+        WholeProgram,
+    };
+
+    /// @brief Contains LLVM's optimisation passes to run when compiling Firestorm code.
+    ///
+    /// @note The passes are LLVM's default module pipeline of a level, built with the new pass manager. It covers
+    /// interprocedural passes such as inlining as well as the function and loop passes, so a module is optimised
+    /// once, when it is complete, instead of function by function.
+    ///
+    /// @note The whole-program pipeline internalises every function but main, as nothing else calls into the
+    /// program. LLVM's link-time pipeline then switches internal functions to fastcc (GlobalOpt), propagates
+    /// constants and promotes arguments across functions (IPSCCP, ArgumentPromotion), inlines them, and removes
+    /// those that are no longer called (GlobalDCE).
+    struct Optimiser {
+        llvm::LoopAnalysisManager loopAnalyses;
+        llvm::FunctionAnalysisManager functionAnalyses;
+        llvm::CGSCCAnalysisManager sccAnalyses;
+        llvm::ModuleAnalysisManager moduleAnalyses;
+        llvm::PassBuilder passBuilder;
+
+        /// @brief Passes run on a module once all of its functions are generated
+        llvm::ModulePassManager modulePasses;
+
+        /// @param machine Target to tune passes for, or nullptr if it is not known yet
+        explicit Optimiser(const OptimiserOptions &options, llvm::TargetMachine *machine = nullptr,
+                           Pipeline pipeline = Pipeline::Module);
+
+        Optimiser(const Optimiser &) = delete;
+
+        void operator=(const Optimiser &) = delete;
+
+        void run(llvm::Module &module);
+    };
+}
+
+#endif //FIRESTORM_OPTIMISER_HPP
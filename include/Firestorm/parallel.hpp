@@ -0,0 +1,96 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_PARALLEL_HPP
+#define FIRESTORM_PARALLEL_HPP
+
+#include "ast.hpp"
+#include "codegen.hpp"
+#include "optimiser.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+
+namespace Firestorm::AST {
+    /// @brief Generates and optimises function definitions concurrently, on a pool of threads.
+    ///
+    /// @note Every thread has a CodeGenerator of its own, and every function is emitted into a module and a context
+    /// of its own, so functions share no LLVM state while they are compiled. Functions are declared in a
+    /// CodeGenerator shared with the caller, which emits everything else, e.g. externs and top-level expressions.
+    ///
+    /// @note Calls are resolved when a function is queued, so a function can only call those declared before it,
+    /// as when it is generated by the CodeGenerator itself.
+    class ParallelCodeGenerator {
+        struct Job {
+            Program program;
+            ExprId function;
+
+            /// @brief Signatures of the functions called by the function
+            std::unordered_map<Utility::Symbol, FunctionSignature> signatures;
+
+            llvm::orc::ThreadSafeModule module;
+            std::exception_ptr error;
+        };
+
+        CodeGenerator &codegen;
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable queued;
+        std::condition_variable done;
+
+        /// @brief Jobs since the last call to finish(), which never move, so threads can work on them unlocked
+        std::deque<Job> jobs;
+        std::size_t next = 0;
+        std::size_t completed = 0;
+        bool stopping = false;
+
+        void work(const OptimiserOptions &options);
+
+    public:
+        /// @param codegen Session in which functions are declared, and which the calls of functions refer to
+        ///
+        /// @param options Passes to optimise the module of every function with
+        ///
+        /// @param threads Number of threads, or 0 for one per core
+        ParallelCodeGenerator(CodeGenerator &codegen, const OptimiserOptions &options, unsigned threads = 0);
+
+        ~ParallelCodeGenerator();
+
+        ParallelCodeGenerator(const ParallelCodeGenerator &) = delete;
+
+        void operator=(const ParallelCodeGenerator &) = delete;
+
+        /// @brief Declares a function in codegen, and queues it to be generated and optimised.
+        ///
+        /// @param program The program, containing the function and nothing else, e.g. as parsed by
+        /// Parser::parseNext()
+        ///
+        /// @param function The Function node of the definition
+        void define(Program program, ExprId function);
+
+        /// @brief Waits for all queued functions.
+        ///
+        /// @return The optimised module of every function, in the order they were queued
+        ///
+        /// @throw The error of the first function that failed to compile
+        std::vector<llvm::orc::ThreadSafeModule> finish();
+    };
+
+    /// @brief Links modules, e.g. those of a ParallelCodeGenerator, into the current module of codegen.
+    ///
+    /// @note Modules are moved into the context of codegen through bitcode, as modules of different contexts
+    /// cannot be linked directly.
+    void linkModules(CodeGenerator &codegen, std::vector<llvm::orc::ThreadSafeModule> modules);
+}
+
+#endif //FIRESTORM_PARALLEL_HPP
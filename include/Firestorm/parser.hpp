@@ -4,45 +4,51 @@
 #ifndef FIRESTORM_PARSER_HPP
 #define FIRESTORM_PARSER_HPP
 
-#include <map>
+#include "ast.hpp"
+
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace Firestorm::Lexing {
     class TokenStream;
 }
 
-namespace Firestorm::AST {
-    class Expr;
-
-    class Prototype;
-
-    class Function;
-}
-
 namespace Firestorm::Parsing {
-    using ExprPtr = std::unique_ptr<AST::Expr>;
-    using ProtoPtr = std::unique_ptr<AST::Prototype>;
-    using FunctionPtr = std::unique_ptr<AST::Function>;
-
-    std::map<std::string, int> &getPrecedenceTable();
+    // Handles of nodes, named after what the parse methods return
+    using ExprPtr = AST::ExprId;
+    using ProtoPtr = AST::ExprId;
+    using FunctionPtr = AST::ExprId;
 
     class Parser {
         Lexing::TokenStream &stream;
-        std::map<std::string, int> precedence_table;
+        bool started = false;
+
+        /// @brief Program that owns the nodes of the statement being parsed
+        AST::Program *program = nullptr;
 
     public:
-        explicit Parser(Lexing::TokenStream &s) : stream(s), precedence_table(getPrecedenceTable()) {}
+        explicit Parser(Lexing::TokenStream &s) : stream(s) {}
+
+        /// @return All statements in source, as a flat AST
+        AST::Program parse();
 
-        std::vector<ExprPtr> parse();
+        /// @brief Parses a single statement, so that a source can be compiled as a stream of statements.
+        ///
+        /// @param p Program to add the nodes of the statement to. The statement itself is not added to
+        /// p.statements.
+        ///
+        /// @return The next statement in source, or no node at the end of source
+        ExprPtr parseNext(AST::Program &p);
 
     private:
         // program      :=  stmts
-        std::vector<ExprPtr> parseProgram();
+        AST::Program parseProgram();
 
         // stmts        :=  stmt SEMICOLON
         //              :=  stmt SEMICOLON stmts
-        std::vector<ExprPtr> parseStmts();
+        void parseStmts(AST::Program &p);
 
         // stmt         :=  tlo_stmt
         //              :=  otr_stmt
@@ -62,7 +68,15 @@ namespace Firestorm::Parsing {
         //              :=  ID COMMA ids
         ProtoPtr parseProto();
 
-        // define_stmt  :=  DEFINE proto expr
+        // params       :=  LPAREN ids RPAREN
+        ProtoPtr parseParams(Utility::Symbol func_name);
+
+        // define_stmt  :=  DEFINE annotations proto expr
+        //
+        // annotations  :=
+        //              :=  ID annotations
+        //
+        // Annotations are fast-math flags, e.g. 'define fast f(x) ...', or 'memo'
         FunctionPtr parseDefineStmt();
 
         // otr_stmt     :=  expr
@@ -70,8 +84,7 @@ namespace Firestorm::Parsing {
 
         // expr         :=  primary
         //              :=  primary bin_op_rhs
-        ExprPtr parseExpr();
-
+        //
         // bin_op_rhs   :=  op primary
         //              :=  op primary bin_op_rhs
         //
@@ -79,45 +92,86 @@ namespace Firestorm::Parsing {
         //              |   MINUS
         //              |   TIMES
         //              |   DIVIDE
-        //              |   EQL
-        //              |   NEQ
-        //              |   GTE
-        //              |   LTE
-        //              |   GT
+        //              |   EQU
         //              |   LT
-        ExprPtr parseBinOpRHS(int exprPre, ExprPtr lhs);
+        //
+        // Expressions are parsed without recursion, so that nesting depth is only limited by memory.
+        // Every construct with a nested expression suspends its parsing on frames until that expression ends.
+        ExprPtr parseExpr();
 
         // primary      :=  num_expr
         //              :=  id_expr
         //              :=  paren_expr
         //              :=  if_expr
-        ExprPtr parsePrimary();
-
-        // num_expr     :=  NUMBER
-        ExprPtr parseNumExpr();
-
+        //              :=  for_expr
+        //
         // id_expr      :=  ID
         //              :=  ID LPAREN args RPAREN
         //
         // args         :=
         //              :=  expr
         //              :=  expr COMMA args
-        ExprPtr parseIdExpr();
-
+        //
         // paren_expr   :=  LPAREN expr RPAREN
-        ExprPtr parseParenExpr();
-
+        //
         // if_expr      :=  IF expr THEN expr ELSE expr
-        ExprPtr parseIfExpr();
-
+        //
         // for_expr     :=  FOR ID EQUALS expr COMMA expr step_clause THEN expr
         //
         // step_clause  :=
         //              :=  COMMA expr
-        ExprPtr parseForExpr();
+        //
+        // @return Whether the primary is complete, otherwise a frame was opened for its first nested expression
+        bool parsePrimary();
 
-        // Util method for bin_op_rhs
-        int getOperatorPrecedence();
+        // num_expr     :=  NUMBER
+        ExprPtr parseNumExpr();
+
+        // Resumes the innermost frame after its nested expression, value, has ended
+        //
+        // @return Whether the construct of the frame is complete, otherwise its next nested expression follows
+        bool closeFrame(ExprPtr value);
+
+        // Combines operators above base with their operands, while they bind at least as tightly as op
+        void reduceOperators(std::uint32_t base, const AST::OperatorInfo &op);
+
+        /// @brief Construct whose parsing is suspended until the expression nested in it ends.
+        struct Frame {
+            enum class Kind : std::uint8_t {
+                Root,
+                Paren,
+                CallArg,
+                IfCond,
+                IfThen,
+                IfElse,
+                ForStart,
+                ForEnd,
+                ForStep,
+                ForBody,
+            };
+
+            Kind kind;
+
+            /// @brief Number of pending operators when the nested expression started
+            std::uint32_t operatorBase;
+
+            /// @brief Callee of CallArg, or the variable of For*
+            Utility::Symbol name{};
+
+            /// @brief Number of pending arguments when the call started
+            std::uint32_t argumentBase = 0;
+
+            /// @brief Clauses parsed so far
+            ExprPtr clauses[3]{};
+        };
+
+        // Explicit stacks of parseExpr, kept to reuse their memory for the next expression
+        std::vector<Frame> frames;
+        std::vector<ExprPtr> operands;
+        std::vector<AST::Operator> operators;
+        std::vector<ExprPtr> arguments;
+
+        void openFrame(Frame::Kind kind, Utility::Symbol name = {});
     };
 }
 
@@ -0,0 +1,37 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_PROFILE_HPP
+#define FIRESTORM_PROFILE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Firestorm::AST {
+    /// @brief Counters of the functions of an instrumented program, as it wrote them when it ended.
+    ///
+    /// @note Counters are numbered in the order their nodes are generated: the calls of the function first, then
+    /// for every if-expression how often either branch ran, and for every for-loop how often its body ran and how
+    /// often the loop ended.
+    struct Profile {
+        /// @brief Counters of every function that was called, by name
+        std::unordered_map<std::string, std::vector<std::uint64_t>> functions;
+
+        /// @brief Calls of the most called function
+        std::uint64_t maxCalls = 0;
+    };
+
+    /// @brief Reads a profile written by an instrumented program, i.e. lines of a function name, the number of its
+    /// counters, and the counters.
+    ///
+    /// @param path Path of the profile
+    ///
+    /// @return The profile, shared by every session it optimises
+    std::shared_ptr<const Profile> readProfile(const std::string &path);
+}
+
+#endif //FIRESTORM_PROFILE_HPP
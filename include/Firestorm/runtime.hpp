@@ -0,0 +1,62 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_RUNTIME_HPP
+#define FIRESTORM_RUNTIME_HPP
+
+#include <cstdint>
+
+// Functions that Firestorm code can declare with extern and call, both in the JIT and in compiled executables.
+// Like every Firestorm function, they take and return doubles.
+extern "C" {
+    /// @brief Prints a number on its own line.
+    ///
+    /// @return 0
+    double putd(double x);
+
+    /// @brief Prints the character with code x.
+    ///
+    /// @return 0
+    double putchard(double x);
+}
+
+// Functions called by compiled code, which Firestorm code can't declare.
+extern "C" {
+    /// @brief Statistics of the cache of a memoized function, laid out as generated by the code generator.
+    struct FirestormMemoStats {
+        const char *name;
+        std::uint64_t hits;
+        std::uint64_t misses;
+
+        /// @brief The statistics registered before, if any
+        FirestormMemoStats *next;
+    };
+
+    /// @brief Registers the statistics of a memoized function, on its first cache miss.
+    void firestorm_register_memo(FirestormMemoStats *stats);
+
+    /// @brief Prints the hit rate of the cache of every memoized function that was called, on stderr.
+    void firestorm_print_memo_stats();
+
+    /// @brief Counters of an instrumented function, laid out as generated by the code generator.
+    struct FirestormProfile {
+        const char *name;
+        std::uint64_t size;
+
+        /// @brief The calls of the function, then the counters of its branches
+        std::uint64_t *counters;
+
+        /// @brief The counters registered before, if any
+        FirestormProfile *next;
+    };
+
+    /// @brief Registers the counters of an instrumented function, on its first call.
+    void firestorm_register_profile(FirestormProfile *profile);
+
+    /// @brief Writes the counters of every instrumented function that was called to a file, replacing it, or
+    /// prints an error on stderr if it can't.
+    void firestorm_write_profile(const char *path);
+}
+
+#endif //FIRESTORM_RUNTIME_HPP
@@ -0,0 +1,37 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#ifndef FIRESTORM_SCAN_HPP
+#define FIRESTORM_SCAN_HPP
+
+#include <cstddef>
+
+namespace Firestorm::Lexing {
+    /// @brief Kernels classifying runs of characters for TokenStream.
+    ///
+    /// Each skip kernel returns a pointer to the first character in [begin, end) outside of its class,
+    /// or end if there is none. Vectorised kernels look at 16 (SSE2) or 32 (AVX2) characters at a time.
+    struct ScanKernels {
+        /// @brief Name of the instruction set the kernels use
+        const char *name;
+
+        /// @brief Skips spaces, tabs, newlines and the other characters of \\s
+        const char *(*skipWhitespaces)(const char *begin, const char *end);
+
+        /// @brief Skips characters allowed after the first character of an identifier, i.e. [_a-zA-Z0-9]
+        const char *(*skipIdentifier)(const char *begin, const char *end);
+
+        /// @brief Skips digits, i.e. [0-9]
+        const char *(*skipDigits)(const char *begin, const char *end);
+
+        /// @brief Counts the newlines in [begin, end)
+        std::size_t (*countNewlines)(const char *begin, const char *end);
+    };
+
+    /// @brief Get the fastest kernels supported by the running CPU, detected on the first call.
+    ///
+    /// @return An instance of ScanKernels
+    const ScanKernels &getScanKernels();
+}
+
+#endif //FIRESTORM_SCAN_HPP
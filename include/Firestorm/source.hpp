@@ -0,0 +1,71 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#ifndef FIRESTORM_SOURCE_HPP
+#define FIRESTORM_SOURCE_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace Firestorm::Lexing {
+    /// @brief Owns the characters of a Firestorm source, which TokenStream scans in place.
+    ///
+    /// @note Files are memory-mapped rather than copied, so peak memory does not grow with the size of source.
+    class Source {
+        std::string name;
+        std::string buffer;
+        const char *data = nullptr;
+        std::size_t length = 0;
+        std::size_t released = 0;
+        bool mapped = false;
+
+        Source() = default;
+
+    public:
+        /// @brief Maps a file into memory. Files that cannot be mapped, e.g. pipes, are read into a buffer instead.
+        ///
+        /// @param path Path of the file
+        ///
+        /// @return An instance of Source
+        static Source fromFile(const std::string &path);
+
+        /// @param text Firestorm code
+        ///
+        /// @param n Name of source used in diagnostics
+        ///
+        /// @return An instance of Source holding text
+        static Source fromString(std::string text, std::string n = "<input>");
+
+        Source(Source &&other) noexcept;
+
+        Source &operator=(Source &&other) noexcept;
+
+        Source(const Source &) = delete;
+
+        Source &operator=(const Source &) = delete;
+
+        ~Source();
+
+        /// @return The characters of source
+        [[nodiscard]]
+        std::string_view view() const { return {data, length}; }
+
+        /// @return The name of source, i.e. its path for files
+        [[nodiscard]]
+        const std::string &getName() const { return name; }
+
+        /// @brief Hints that characters before offset will not be read again, so their memory can be reclaimed.
+        ///
+        /// @note This is what makes streaming large files possible. Reading released characters is still valid,
+        /// it only costs reloading them from disk.
+        ///
+        /// @param offset Index of the first character still in use
+        void release(std::size_t offset);
+
+    private:
+        void unmap();
+    };
+}
+
+#endif //FIRESTORM_SOURCE_HPP
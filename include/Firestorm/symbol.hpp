@@ -0,0 +1,47 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#ifndef FIRESTORM_SYMBOL_HPP
+#define FIRESTORM_SYMBOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace Firestorm::Utility {
+    /// @brief Compact handle of an interned identifier.
+    ///
+    /// Equal names are always interned to the same symbol, so symbols are compared and hashed by id alone.
+    /// The default symbol stands for the empty name.
+    struct Symbol {
+        std::uint32_t id = 0;
+
+        friend bool operator==(Symbol a, Symbol b) { return a.id == b.id; }
+
+        friend bool operator!=(Symbol a, Symbol b) { return a.id != b.id; }
+
+        friend bool operator<(Symbol a, Symbol b) { return a.id < b.id; }
+    };
+
+    /// @brief Get the symbol of a name from the global symbol table, adding the name if it is new.
+    ///
+    /// @note This is safe to call from multiple threads.
+    ///
+    /// @param name The name to intern
+    ///
+    /// @return The symbol of name
+    Symbol internSymbol(std::string_view name);
+
+    /// @param symbol A symbol returned by internSymbol()
+    ///
+    /// @return The name of symbol, which stays valid for the lifetime of the program
+    std::string_view getSymbolName(Symbol symbol);
+}
+
+template<>
+struct std::hash<Firestorm::Utility::Symbol> {
+    std::size_t operator()(Firestorm::Utility::Symbol symbol) const noexcept { return symbol.id; }
+};
+
+#endif //FIRESTORM_SYMBOL_HPP
@@ -0,0 +1,44 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+
+#ifndef FIRESTORM_VM_HPP
+#define FIRESTORM_VM_HPP
+
+#include "bytecode.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace Firestorm::Backend {
+    /// @brief Runs bytecode with a threaded interpreter, without LLVM, so that scripts start immediately.
+    ///
+    /// @note Calls don't recurse in C++: frames are kept in a vector, and the registers of all of them in one
+    /// stack, in which the frame of a callee starts at the arguments given by its caller.
+    class VM {
+        struct Frame {
+            const BytecodeFunction *function;
+            const Instruction *returnAddress;
+            std::size_t base;
+        };
+
+        std::vector<double> stack;
+        std::vector<Frame> frames;
+
+        /// @brief Makes the stack hold at least size registers.
+        void reserve(std::size_t size);
+
+        double callNative(BytecodeFunction &function, const double *args);
+
+    public:
+        /// @brief Functions that code run by the VM can call
+        BytecodeModule module;
+
+        /// @brief Runs a function without arguments, e.g. one wrapping a top-level expression.
+        ///
+        /// @return The value returned by the function
+        double run(const BytecodeFunction &function);
+    };
+}
+
+#endif //FIRESTORM_VM_HPP
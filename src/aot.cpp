@@ -0,0 +1,122 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/aot.hpp"
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/jit.hpp"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
+#include <llvm/Support/TargetRegistry.h>
+#endif
+
+namespace Firestorm::Backend {
+    namespace {
+        llvm::CodeGenOpt::Level getCodegenLevel(AST::OptimisationLevel level) {
+            switch (level) {
+                case AST::OptimisationLevel::O0:
+                    return llvm::CodeGenOpt::None;
+                case AST::OptimisationLevel::O1:
+                    return llvm::CodeGenOpt::Less;
+                case AST::OptimisationLevel::O3:
+                    return llvm::CodeGenOpt::Aggressive;
+                default:
+                    return llvm::CodeGenOpt::Default;
+            }
+        }
+    }
+
+    std::unique_ptr<llvm::TargetMachine> createHostTargetMachine(AST::OptimisationLevel level) {
+        initialiseNativeTarget();
+
+        auto triple = llvm::sys::getDefaultTargetTriple();
+        std::string error;
+        auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) throw Utility::getError(Utility::BE, "Cannot compile for '{}': {}", triple, error);
+
+        // Use everything the host CPU supports
+        llvm::SubtargetFeatures features;
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+            for (auto &feature: hostFeatures) features.AddFeature(feature.first(), feature.second);
+        }
+
+        // Position-independent, as C compilers link executables as PIE by default
+        llvm::TargetOptions options;
+        return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+                triple, llvm::sys::getHostCPUName(), features.getString(), options, llvm::Reloc::PIC_,
+                llvm::None, getCodegenLevel(level)));
+    }
+
+    void addEntryPoint(llvm::Module &module, const std::vector<llvm::Function *> &statements,
+                       bool printMemoStats, const std::string &profile) {
+        auto &context = module.getContext();
+        if (module.getFunction("main")) {
+            throw Utility::getError(Utility::CE, "Function 'main' is reserved for the entry point of executables");
+        }
+
+        auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false);
+        auto main = llvm::Function::Create(type, llvm::Function::ExternalLinkage, "main", module);
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", main));
+        for (auto statement: statements) builder.CreateCall(statement);
+        if (printMemoStats) {
+            auto print = module.getOrInsertFunction("firestorm_print_memo_stats", builder.getVoidTy());
+            builder.CreateCall(print);
+        }
+        if (!profile.empty()) {
+            // The path is written into the executable, so that every run of it writes the same file
+            auto write = module.getOrInsertFunction("firestorm_write_profile", builder.getVoidTy(),
+                                                    builder.getInt8PtrTy());
+            builder.CreateCall(write, {builder.CreateGlobalStringPtr(profile, "profile.path")});
+        }
+        builder.CreateRet(builder.getInt32(0));
+        llvm::verifyFunction(*main);
+    }
+
+    void optimiseModule(llvm::Module &module, llvm::TargetMachine &machine, const AST::OptimiserOptions &options,
+                        AST::Pipeline pipeline) {
+        module.setDataLayout(machine.createDataLayout());
+        module.setTargetTriple(machine.getTargetTriple().str());
+        AST::Optimiser(options, &machine, pipeline).run(module);
+    }
+
+    void emitObjectFile(llvm::Module &module, llvm::TargetMachine &machine, const std::string &path) {
+        module.setDataLayout(machine.createDataLayout());
+        module.setTargetTriple(machine.getTargetTriple().str());
+
+        std::error_code error;
+        llvm::raw_fd_ostream file(path, error, llvm::sys::fs::OF_None);
+        if (error) throw Utility::getError(Utility::BE, "Cannot open '{}': {}", path, error.message());
+
+        llvm::legacy::PassManager passes;
+        if (machine.addPassesToEmitFile(passes, file, nullptr, llvm::CGFT_ObjectFile)) {
+            throw Utility::getError(Utility::BE, "Cannot emit object files for '{}'", machine.getTargetTriple().str());
+        }
+        passes.run(module);
+        file.flush();
+    }
+
+    void linkExecutable(const std::string &object, const std::string &path) {
+        auto compiler = llvm::sys::findProgramByName("cc");
+        if (!compiler) throw Utility::getError(Utility::BE, "Cannot find a C compiler to link with");
+
+        std::vector<llvm::StringRef> args{*compiler, object, FIRESTORM_RUNTIME_LIBRARY, "-lm", "-o", path};
+        std::string error;
+        auto status = llvm::sys::ExecuteAndWait(*compiler, args, llvm::None, {}, 0, 0, &error);
+        if (status != 0) {
+            throw Utility::getError(Utility::BE, "Linking '{}' failed{}", path, error.empty() ? "" : ": " + error);
+        }
+    }
+}
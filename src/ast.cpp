@@ -2,366 +2,277 @@
 // Created by Nguyen Thai Binh on 17/1/22.
 //
 #include "Firestorm/ast.hpp"
-#include "Firestorm/codegen.hpp"
 #include "Firestorm/custom_exceptions.hpp"
 
 #include <fmt/format.h>
-#include <sstream>
-#include <llvm/IR/Verifier.h>
+#include <iterator>
+#include <utility>
+#include <vector>
 
 namespace Firestorm::AST {
-    using fmt::format;
 
-    CodeGenerator &getCodegen() {
-        static CodeGenerator codegen;
-        return codegen;
+    void Program::clear() {
+        numbers.clear();
+        variables.clear();
+        binaries.clear();
+        calls.clear();
+        ifs.clear();
+        fors.clear();
+        prototypes.clear();
+        functions.clear();
+        arguments.clear();
+        parameters.clear();
+        statements.clear();
     }
 
-    auto &Context() {
-        return getCodegen().context;
+    namespace {
+        /// @brief Visitor building the string representation of every kind of node.
+        ///
+        /// @note Nodes are printed without recursion, straight into out: a node runs in stages, each appending
+        /// the text before one child and scheduling that child, then the last one closes the node.
+        struct Printer {
+            const Program &program;
+            std::string out;
+
+            /// @brief Nodes being printed, and their current stage
+            std::vector<std::pair<ExprId, std::uint32_t>> tasks;
+
+            std::string print(ExprId id) {
+                schedule(id);
+                while (!tasks.empty()) visit(program, tasks.back().first, *this);
+                return std::move(out);
+            }
+
+            void schedule(ExprId id) {
+                tasks.emplace_back(id, 0);
+            }
+
+            std::uint32_t &stage() {
+                return tasks.back().second;
+            }
+
+            template<class... Args>
+            void append(fmt::format_string<Args...> fmt, Args &&... args) {
+                fmt::format_to(std::back_inserter(out), fmt, std::forward<Args>(args)...);
+            }
+
+            /// @brief Ends the current node, with the text after its last child.
+            void finish(std::string_view closing) {
+                out += closing;
+                tasks.pop_back();
+            }
+
+            void operator()(const NumberExpr &expr) {
+                append("Number({})", expr.value);
+                tasks.pop_back();
+            }
+
+            void operator()(const VariableExpr &expr) {
+                append("Variable({})", Utility::getSymbolName(expr.name));
+                tasks.pop_back();
+            }
+
+            void operator()(const BinaryExpr &expr) {
+                switch (stage()++) {
+                    case 0:
+                        out += "BinOp(lhs=";
+                        return schedule(expr.lhs);
+                    case 1:
+                        append(", op='{}', rhs=", getOperatorInfo(expr.op).spelling);
+                        return schedule(expr.rhs);
+                    default:
+                        return finish(")");
+                }
+            }
+
+            void operator()(const CallExpr &expr) {
+                auto i = stage()++;
+                if (i == 0) append("Call(callee={}, args=[", Utility::getSymbolName(expr.callee));
+                if (i == expr.argCount) return finish("])");
+
+                // Arguments are separated by a delimiter
+                if (i > 0) out += ", ";
+                schedule(program.getArgs(expr)[i]);
+            }
+
+            void operator()(const Prototype &proto) {
+                // Concatenate all args
+                std::vector<std::string_view> arg_names;
+                for (auto arg: program.getArgs(proto)) arg_names.push_back(Utility::getSymbolName(arg));
+                append("Proto(name={}, args=[{}])", Utility::getSymbolName(proto.name),
+                       fmt::join(arg_names.begin(), arg_names.end(), ", "));
+                tasks.pop_back();
+            }
+
+            void operator()(const Function &function) {
+                switch (stage()++) {
+                    case 0:
+                        out += "Function(proto=";
+                        return schedule(function.proto);
+                    case 1:
+                        out += ", body=";
+                        return schedule(function.body);
+                    default:
+                        return finish(")");
+                }
+            }
+
+            void operator()(const IfExpr &expr) {
+                switch (stage()++) {
+                    case 0:
+                        out += "Conditional(if=";
+                        return schedule(expr.condition_clause);
+                    case 1:
+                        out += ", then=";
+                        return schedule(expr.then_clause);
+                    case 2:
+                        out += ", else=";
+                        return schedule(expr.else_clause);
+                    default:
+                        return finish(")");
+                }
+            }
+
+            void operator()(const ForExpr &expr) {
+                switch (stage()++) {
+                    case 0:
+                        append("ForExpr(var={}, start=", Utility::getSymbolName(expr.varName));
+                        return schedule(expr.start);
+                    case 1:
+                        out += ", end=";
+                        return schedule(expr.end);
+                    case 2:
+                        out += ", step=";
+                        if (expr.step) return schedule(expr.step);
+                        out += "None";
+                        return;
+                    case 3:
+                        out += ", body=";
+                        return schedule(expr.body);
+                    default:
+                        return finish(")");
+                }
+            }
+        };
     }
 
-    auto &Builder() {
-        return getCodegen().builder;
+    std::uint8_t getFastMathFlags(std::string_view name) {
+        if (name == "reassoc") return FastMath::Reassoc;
+        if (name == "nnan") return FastMath::NoNaNs;
+        if (name == "ninf") return FastMath::NoInfs;
+        if (name == "nsz") return FastMath::NoSignedZeros;
+        if (name == "arcp") return FastMath::AllowReciprocal;
+        if (name == "contract") return FastMath::AllowContract;
+        if (name == "afn") return FastMath::ApproxFunc;
+        if (name == "fast") return FastMath::Fast;
+        return 0;
     }
 
-    auto &Module() {
-        return getCodegen().module;
-    }
-
-    auto &Optimiser() {
-        return getCodegen().optimiser;
-    }
-
-    auto &NamedValues() {
-        return getCodegen().namedValues;
-    }
-
-    const auto &DoubleType() {
-        static auto t = llvm::Type::getDoubleTy(Context());
-        return t;
-    }
-
-    std::string NumberExpr::toString() const {
-        return format("Number({})", value);
-    }
-
-    llvm::Value *NumberExpr::generateIR() const {
-        return llvm::ConstantFP::get(Context(), llvm::APFloat(value));
-    }
-
-    std::string VariableExpr::toString() const {
-        return format("Variable({})", name);
-    }
-
-    llvm::Value *VariableExpr::generateIR() const {
-        // Look up if variable declared
-        auto value = NamedValues()[name];
-        if (!value) {
-            throw Utility::getError(Utility::CE, "Unknown variable '{}'", name);
-        }
-        return value;
-    }
-
-    std::string BinaryExpr::toString() const {
-        auto l = lhs->toString();
-        auto r = rhs->toString();
-        return format("BinOp(lhs={}, op='{}', rhs={})", l, op, r);
-    }
-
-    llvm::Value *BinaryExpr::generateIR() const {
-        auto lhs_code = lhs->generateIR();
-        auto rhs_code = rhs->generateIR();
-
-        if (op == "+")
-            return Builder().CreateFAdd(lhs_code, rhs_code, "add_tmp");
-        else if (op == "-")
-            return Builder().CreateFSub(lhs_code, rhs_code, "sub_tmp");
-        else if (op == "*")
-            return Builder().CreateFMul(lhs_code, rhs_code, "mul_tmp");
-        else if (op == "/")
-            return Builder().CreateFDiv(lhs_code, rhs_code, "div_tmp");
-        else if (op == "==") {
-            lhs_code = Builder().CreateICmpEQ(lhs_code, rhs_code, "cmp_eq_tmp");
-            return Builder().CreateUIToFP(lhs_code, DoubleType(), "bool_tmp");
-        } else if (op == "<") {
-            lhs_code = Builder().CreateFCmpULE(lhs_code, rhs_code, "cmp_lt_tmp");
-            return Builder().CreateUIToFP(lhs_code, DoubleType(), "bool_tmp");
-        } else {
-            throw Utility::getError(Utility::CE, "Invalid binary operator, found '{}'", op);
-        }
-    }
-
-    std::string CallExpr::toString() const {
-        std::stringstream ss;
-        for (const auto &ptr: args) {
-            ss << ptr->toString();
-            ss << ", ";
+    std::uint32_t countChildren(const Program &program, ExprId id) {
+        switch (id.kind()) {
+            case ExprKind::Binary:
+                return 2;
+            case ExprKind::Call:
+                return program.get<CallExpr>(id).argCount;
+            case ExprKind::If:
+                return 3;
+            case ExprKind::For:
+                return 4;
+            default:
+                return 0;
         }
-        auto s = ss.str();
-        // Remove last delimiter
-        s = s.substr(0, s.length() - 2);
-        return format("Call(callee={}, args=[{}])", callee, s);
     }
 
-    llvm::Value *CallExpr::generateIR() const {
-        // Look up function
-        auto func = Module().getFunction(callee);
-
-        if (!func) {
-            throw Utility::getError(Utility::CE, "Unknown function '{}'", callee);
+    ExprId &getChild(Program &program, ExprId id, std::uint32_t i) {
+        switch (id.kind()) {
+            case ExprKind::Binary: {
+                auto &expr = program.get<BinaryExpr>(id);
+                return i == 0 ? expr.lhs : expr.rhs;
+            }
+            case ExprKind::Call:
+                return program.arguments[program.get<CallExpr>(id).firstArg + i];
+            case ExprKind::If: {
+                auto &expr = program.get<IfExpr>(id);
+                return i == 0 ? expr.condition_clause : i == 1 ? expr.then_clause : expr.else_clause;
+            }
+            case ExprKind::For: {
+                auto &expr = program.get<ForExpr>(id);
+                return i == 0 ? expr.start : i == 1 ? expr.end : i == 2 ? expr.step : expr.body;
+            }
+            default:
+                throw Utility::getError(Utility::FE, "AST node has no children");
         }
-
-        // Check for argument mismatch
-        auto a = func->arg_size();
-        auto b = args.size();
-        if (a != b) {
-            throw Utility::getError(Utility::CE, "Function '{}' requires {} arguments, given {}", callee, a, b);
-        }
-
-        // Codegen for args
-        std::vector<llvm::Value *> args_code;
-        for (const auto &arg: args) {
-            args_code.push_back(arg->generateIR());
-            if (!args_code.back()) return nullptr;
-        }
-
-        return Builder().CreateCall(func, args_code);
     }
 
-    std::string Prototype::toString() const {
-        // Concatenate all args
-        auto arg_con = fmt::to_string(fmt::join(args.begin(), args.end(), ", "));
-        return format("Proto(name={}, args=[{}])", name, arg_con);
+    ExprId getChild(const Program &program, ExprId id, std::uint32_t i) {
+        return getChild(const_cast<Program &>(program), id, i);
     }
 
-    llvm::Function *Prototype::generateIR() const {
-        // Make argument types
-        // Firestorm only supports values that are doubles
-        // Hence, arguments of all proto has the form (double, ...)
-        std::vector<llvm::Type *> args_type{args.size(), DoubleType()};
-
-        // Make function type here
-        // Similarly, the return type is double
-        auto func_type = llvm::FunctionType::get(DoubleType(), args_type, false);
-
-        auto func = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
-                                           name, Module());
-
-        // Set names for easy reference
-        unsigned idx = 0;
-        for (auto &arg: func->args()) {
-            arg.setName(args[idx++]);
+    namespace {
+        /// @brief Copies a node into to, without its children, which still refer to nodes of from.
+        ExprId copyNode(Program &to, const Program &from, ExprId id) {
+            switch (id.kind()) {
+                case ExprKind::Number:
+                    return to.add(from.get<NumberExpr>(id));
+                case ExprKind::Variable:
+                    return to.add(from.get<VariableExpr>(id));
+                case ExprKind::Binary:
+                    return to.add(from.get<BinaryExpr>(id));
+                case ExprKind::Call: {
+                    auto call = from.get<CallExpr>(id);
+                    auto args = from.getArgs(call);
+                    call.firstArg = (std::uint32_t) to.arguments.size();
+                    to.arguments.insert(to.arguments.end(), args.begin(), args.end());
+                    return to.add(call);
+                }
+                case ExprKind::If:
+                    return to.add(from.get<IfExpr>(id));
+                case ExprKind::For:
+                    return to.add(from.get<ForExpr>(id));
+                case ExprKind::Prototype: {
+                    auto proto = from.get<Prototype>(id);
+                    auto params = from.getArgs(proto);
+                    proto.firstArg = (std::uint32_t) to.parameters.size();
+                    to.parameters.insert(to.parameters.end(), params.begin(), params.end());
+                    return to.add(proto);
+                }
+                case ExprKind::Function: {
+                    auto function = from.get<Function>(id);
+                    function.proto = copyNode(to, from, function.proto);
+                    function.body = copyTree(to, from, function.body);
+                    return to.add(function);
+                }
+            }
+            throw Utility::getError(Utility::FE, "Invalid AST node");
         }
-        return func;
     }
 
-    std::string Function::toString() const {
-        auto p = proto->toString();
-        auto b = body->toString();
-        return format("Function(proto={}, body={})", p, b);
-    }
-
-    llvm::Value *Function::generateIR() const {
-        // Check for existing function
-        auto func = Module().getFunction(proto->name);
-
-        // If function not found, i.e. not yet declared, defined
-        // then codegen its proto
-        if (!func) func = proto->generateIR();
-
-        // If codegen failed, idk man :v
-        if (!func) return nullptr;
-
-        // Check for existing definition
-        if (!func->empty()) {
-            throw Utility::getError(Utility::CE, "Function '{}' cannot be redefined", proto->name);
-        }
-
-        // Create a basic block for function, i.e. function body
-        // SetInsertPoint to specify that instructions shall be appended to block
-        auto block = llvm::BasicBlock::Create(Context(), "entry", func);
-        Builder().SetInsertPoint(block);
-
-        // Record function arguments
-        NamedValues().clear();
-        for (auto &arg: func->args()) {
-            NamedValues()[arg.getName().str()] = &arg;
-        }
-
-        // Implement function body
-        if (auto body_code = body->generateIR()) {
-            // Create return value
-            Builder().CreateRet(body_code);
-
-            // Verify function well-formed-ness
-            llvm::verifyFunction(*func);
-
-            // Perform optimisation
-            // Notes: Temporary remove optimiser since its API is changing
-            // and no one knows how to use the new one.
-            Optimiser().passManager.run(*func);
-
-            return func;
+    ExprId copyTree(Program &to, const Program &from, ExprId id) {
+        // Pairs of a node in from and its copy, whose children are copied one per stage
+        struct Task {
+            ExprId source, copy;
+            std::uint32_t stage = 0;
+        };
+        auto root = copyNode(to, from, id);
+        std::vector<Task> tasks{{id, root}};
+        while (!tasks.empty()) {
+            auto task = tasks.back();
+            if (task.stage == countChildren(from, task.source)) {
+                tasks.pop_back();
+                continue;
+            }
+            ++tasks.back().stage;
+
+            auto child = getChild(from, task.source, task.stage);
+            if (!child) continue;
+            auto copy = copyNode(to, from, child);
+            getChild(to, task.copy, task.stage) = copy;
+            tasks.push_back({child, copy});
         }
-
-        // Otherwise, body codegen failed
-        // then remove from module
-        // This solves problems when functions are typed incorrectly in interpreter mode
-        // allowing them to redefine it
-        func->removeFromParent();
-        return nullptr;
-    }
-
-    std::string IfExpr::toString() const {
-        auto i = condition_clause->toString();
-        auto t = then_clause->toString();
-        auto e = else_clause->toString();
-        return fmt::format("Conditional(if={}, then={}, else={})", i, t, e);
-    }
-
-    llvm::Value *IfExpr::generateIR() const {
-        // codegen condition_clause
-        auto cond_code = condition_clause->generateIR();
-        if (!cond_code) return nullptr;
-
-        // Convert cond_code to bool by comparing with zero
-        // Here we utilise NumberExpr
-        auto zero_code = NumberExpr(0).generateIR();
-        cond_code = Builder().CreateFCmpONE(cond_code, zero_code, "if_cond");
-
-        auto func = Builder().GetInsertBlock()->getParent();
-
-        // Generate blocks for then, else, if_cont (merging then and else)
-        auto then_block = llvm::BasicBlock::Create(Context(), "then", func);
-        auto else_block = llvm::BasicBlock::Create(Context(), "else");
-        auto cont_block = llvm::BasicBlock::Create(Context(), "if_cont");
-
-        // Create conditional branch
-        Builder().CreateCondBr(cond_code, then_block, else_block);
-
-        // codegen then_code to insert to then_block
-        Builder().SetInsertPoint(then_block);
-        auto then_code = then_clause->generateIR();
-        if (!then_code) return nullptr;
-
-        // Make cont_block a branch from then_block
-        // This is necessary because later, else_block will also branch to cont_block
-        // NOTE: LLVM strictly require all branch to terminate explicitly
-        Builder().CreateBr(cont_block);
-
-        // codegen of then_clause could change block
-        // Hence, we need to retrieve it
-        then_block = Builder().GetInsertBlock();
-
-        // codegen else_code to insert to else_code
-        // But first add else_block to func
-        func->getBasicBlockList().push_back(else_block);
-        Builder().SetInsertPoint(else_block);
-        auto else_code = else_clause->generateIR();
-        if (!else_code) return nullptr;
-
-        // Branch to cont_block (similar to above)
-        Builder().CreateBr(cont_block);
-
-        // codegen of else_clause could change block
-        // Hence, we need to retrieve it
-        else_block = Builder().GetInsertBlock();
-
-        // Now insert cont_block into function
-        func->getBasicBlockList().push_back(cont_block);
-        Builder().SetInsertPoint(cont_block);
-
-        // Make PHI node
-        auto phi = Builder().CreatePHI(DoubleType(), 2, "if_tmp");
-        phi->addIncoming(then_code, then_block);
-        phi->addIncoming(else_code, else_block);
-        return phi;
-    }
-
-    std::string ForExpr::toString() const {
-        auto s = start->toString();
-        auto e = end->toString();
-        auto s1 = step->toString();
-        auto b = body->toString();
-
-        return fmt::format("ForExpr(var={}, start={}, end={}, step={}, body={})", varName, s, e, s1, b);
+        return root;
     }
 
-    llvm::Value *ForExpr::generateIR() const {
-        // codegen start value
-        auto start_code = start->generateIR();
-        if (!start_code) return nullptr;
-
-        // Get pre-loop block
-        auto pre_entry_block = Builder().GetInsertBlock();
-
-        // Get parent function
-        auto func = pre_entry_block->getParent();
-
-        // Create loop block
-        auto loop_block = llvm::BasicBlock::Create(Context(), "loop", func);
-
-        // Create fall through pre-entry block to loop block
-        Builder().CreateBr(loop_block);
-
-        // Set insert point to loop block to put instructions there
-        Builder().SetInsertPoint(loop_block);
-
-        // Create PHI node
-        // As loop block can come from pre-entry block as well as itself
-        auto variable = Builder().CreatePHI(DoubleType(), 2, varName);
-        variable->addIncoming(start_code, pre_entry_block);
-
-        // Add loop variable to symbol table
-        // Save the existing if any
-        auto existing_value = NamedValues()[varName];
-        NamedValues()[varName] = variable;
-
-        // codegen body expression
-        // We don't have to assign it to a variable because it's not needed
-        // and insert point is already points to loop block
-        if (!body->generateIR()) return nullptr;
-
-        // codegen step value
-        // If there isn't one (since it's optional), set it to default value of 1
-        llvm::Value *step_code;
-        if (step) {
-            step_code = step->generateIR();
-            if (!step_code) return nullptr;
-        } else {
-            step_code = NumberExpr(1.0).generateIR();
-        }
-
-        auto next_variable = Builder().CreateFAdd(variable, step_code, "next_" + varName);
-
-        // codegen end condition
-        auto end_code = end->generateIR();
-        if (!end_code) return nullptr;
-
-        // convert end condition to bool by comparing non-equal to 0.0
-        end_code = Builder().CreateFCmpONE(end_code, NumberExpr(0.0).generateIR(), "loop_cond");
-
-        // create after loop block
-        auto loop_end_block = Builder().GetInsertBlock();
-        auto after_loop_block = llvm::BasicBlock::Create(Context(), "after_loop", func);
-
-        // create conditional branch based on end code
-        // If true, go back to loop block, otherwise, go to after loop block
-        Builder().CreateCondBr(end_code, loop_block, after_loop_block);
-
-        // Set insert point to after block so any new code will go there
-        Builder().SetInsertPoint(after_loop_block);
-
-        // Add next variable as the second entry of PHI node
-        variable->addIncoming(next_variable, loop_end_block);
-
-        // Restore existing variable saved earlier
-        if (existing_value) NamedValues()[varName] = existing_value;
-        else NamedValues().erase(varName);
-
-        // Set return value for for-loop
-        // For now, it is set to default of 0.0
-        return NumberExpr(0.0).generateIR();
+    std::string toString(const Program &program, ExprId id) {
+        return Printer{program}.print(id);
     }
 }
@@ -0,0 +1,161 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/ast_optimiser.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+namespace Firestorm::AST {
+    namespace {
+        bool isNumber(const Program &program, ExprId id, double value) {
+            if (id.kind() != ExprKind::Number) return false;
+            auto number = program.get<NumberExpr>(id).value;
+            return number == value && std::signbit(number) == std::signbit(value);
+        }
+
+        /// @return Whether evaluating a node has no effect, i.e. it calls no function, and surely terminates, as
+        /// it contains no loop
+        bool hasNoEffect(const Program &program, ExprId id) {
+            std::vector<ExprId> pending{id};
+            while (!pending.empty()) {
+                auto next = pending.back();
+                pending.pop_back();
+                if (next.kind() == ExprKind::Call || next.kind() == ExprKind::For) return false;
+                for (std::uint32_t i = 0; i < countChildren(program, next); ++i) {
+                    if (auto child = getChild(program, next, i)) pending.push_back(child);
+                }
+            }
+            return true;
+        }
+
+        /// @brief Applies rules to every node under root, children first.
+        ///
+        /// @return The node replacing root
+        ExprId rewrite(Program &program, ExprId root, const std::vector<ASTRule> &rules) {
+            struct Task {
+                ExprId id;
+                std::uint32_t stage = 0;
+            };
+            std::vector<Task> tasks{{root}};
+            while (true) {
+                // One child per stage
+                auto &task = tasks.back();
+                if (task.stage < countChildren(program, task.id)) {
+                    auto child = getChild(program, task.id, task.stage++);
+                    if (child) tasks.push_back({child});
+                    continue;
+                }
+
+                auto id = task.id;
+                tasks.pop_back();
+                for (const auto &rule: rules) id = rule(program, id);
+
+                if (tasks.empty()) return id;
+                auto &parent = tasks.back();
+                getChild(program, parent.id, parent.stage - 1) = id;
+            }
+        }
+    }
+
+    ASTOptimiser::ASTOptimiser(OptimisationLevel level, EvaluationLimits limits) : evaluator(limits) {
+        if (level == OptimisationLevel::O0) return;
+        auto evaluateCalls = [this](Program &program, ExprId id) { return evaluator.fold(program, id); };
+        rules = {evaluateCalls, foldConstants, simplifyIdentities, eliminateDeadBranches, dropUnusedValues};
+    }
+
+    ExprId ASTOptimiser::run(Program &program, ExprId stmt) {
+        if (rules.empty()) return stmt;
+        switch (stmt.kind()) {
+            case ExprKind::Prototype:
+                evaluator.declare(program, stmt);
+                return stmt;
+            case ExprKind::Function: {
+                auto body = rewrite(program, program.get<Function>(stmt).body, rules);
+                program.get<Function>(stmt).body = body;
+                evaluator.declare(program, stmt);
+                return stmt;
+            }
+            default:
+                return rewrite(program, stmt, rules);
+        }
+    }
+
+    ExprId foldConstants(Program &program, ExprId id) {
+        if (id.kind() != ExprKind::Binary) return id;
+        const auto &expr = program.get<BinaryExpr>(id);
+        if (expr.lhs.kind() != ExprKind::Number || expr.rhs.kind() != ExprKind::Number) return id;
+
+        // The same operations as the IR of BinaryExpr
+        auto lhs = program.get<NumberExpr>(expr.lhs).value;
+        auto rhs = program.get<NumberExpr>(expr.rhs).value;
+        double value;
+        switch (expr.op) {
+            case Operator::Add:
+                value = lhs + rhs;
+                break;
+            case Operator::Sub:
+                value = lhs - rhs;
+                break;
+            case Operator::Mul:
+                value = lhs * rhs;
+                break;
+            case Operator::Div:
+                value = lhs / rhs;
+                break;
+            case Operator::Equ:
+                value = lhs == rhs;
+                break;
+            case Operator::Lt:
+                // Unordered, like 'fcmp ult'
+                value = !(lhs >= rhs);
+                break;
+            default:
+                return id;
+        }
+        return program.add(NumberExpr{value});
+    }
+
+    ExprId simplifyIdentities(Program &program, ExprId id) {
+        if (id.kind() != ExprKind::Binary) return id;
+        const auto &expr = program.get<BinaryExpr>(id);
+
+        // Adding +0 or multiplying by -1 would change the sign of zero, so they are kept
+        switch (expr.op) {
+            case Operator::Mul:
+                if (isNumber(program, expr.rhs, 1)) return expr.lhs;
+                if (isNumber(program, expr.lhs, 1)) return expr.rhs;
+                return id;
+            case Operator::Div:
+                return isNumber(program, expr.rhs, 1) ? expr.lhs : id;
+            case Operator::Sub:
+                return isNumber(program, expr.rhs, 0) ? expr.lhs : id;
+            case Operator::Add:
+                if (isNumber(program, expr.rhs, -0.0)) return expr.lhs;
+                if (isNumber(program, expr.lhs, -0.0)) return expr.rhs;
+                return id;
+            default:
+                return id;
+        }
+    }
+
+    ExprId eliminateDeadBranches(Program &program, ExprId id) {
+        if (id.kind() != ExprKind::If) return id;
+        const auto &expr = program.get<IfExpr>(id);
+        if (expr.condition_clause.kind() != ExprKind::Number) return id;
+
+        // Like 'fcmp one', NaN takes the else branch
+        auto condition = program.get<NumberExpr>(expr.condition_clause).value;
+        return condition < 0 || condition > 0 ? expr.then_clause : expr.else_clause;
+    }
+
+    ExprId dropUnusedValues(Program &program, ExprId id) {
+        if (id.kind() != ExprKind::For) return id;
+        auto body = program.get<ForExpr>(id).body;
+        if (body.kind() == ExprKind::Number || !hasNoEffect(program, body)) return id;
+
+        auto zero = program.add(NumberExpr{0});
+        program.get<ForExpr>(id).body = zero;
+        return id;
+    }
+}
@@ -0,0 +1,367 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/bytecode.hpp"
+#include "Firestorm/custom_exceptions.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace Firestorm::Backend {
+    namespace {
+        /// @brief Visitor compiling every kind of node to bytecode, writing its value into a register.
+        ///
+        /// @note Like IRGenerator, nodes are compiled without recursion: every task runs in stages, each
+        /// scheduling at most one child. Registers are allocated as a stack, so the temporaries of a node are
+        /// freed when it finishes.
+        struct BytecodeCompiler {
+            struct Task {
+                AST::ExprId id;
+                std::uint32_t stage = 0;
+
+                /// @brief Register receiving the value of the node
+                std::uint32_t dest = 0;
+
+                /// @brief First register allocated by the node, which are freed when it finishes
+                std::uint32_t mark = 0;
+
+                /// @brief Registers, instructions and variables the node keeps between stages
+                std::uint32_t saved[4] = {};
+
+                /// @brief Whether the function returns the value of the node, so that calls in it are tail calls
+                bool tail = false;
+            };
+
+            BytecodeModule &module;
+            const AST::Program &program;
+            BytecodeFunction function;
+            std::unordered_map<Utility::Symbol, std::uint32_t> variables;
+            std::uint32_t top = 0;
+            std::vector<Task> tasks;
+
+            /// @brief Marks a variable that is not bound in saved, as registers are 16-bit
+            static constexpr std::uint32_t unbound = UINT32_MAX;
+
+            std::uint32_t allocate(std::uint32_t count = 1) {
+                auto first = top;
+                top += count;
+                if (top > UINT16_MAX) {
+                    throw Utility::getError(Utility::CE, "Function '{}' needs too many registers",
+                                            Utility::getSymbolName(function.name));
+                }
+                function.registerCount = std::max(function.registerCount, top);
+                return first;
+            }
+
+            std::uint32_t here() const {
+                return (std::uint32_t) function.code.size();
+            }
+
+            void emit(Opcode op, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0) {
+                function.code.push_back({op, (std::uint16_t) a, (std::uint16_t) b, (std::uint16_t) c});
+            }
+
+            void emitWide(Opcode op, std::uint32_t a, std::uint32_t wide) {
+                function.code.push_back(Instruction::withWide(op, (std::uint16_t) a, wide));
+            }
+
+            /// @brief Points the jump at code[at] to the next instruction.
+            void patch(std::uint32_t at) {
+                auto &jump = function.code[at];
+                jump = Instruction::withWide(jump.op, jump.a, here());
+            }
+
+            void loadConstant(std::uint32_t dest, double value) {
+                emitWide(Opcode::LoadConst, dest, (std::uint32_t) function.constants.size());
+                function.constants.push_back(value);
+            }
+
+            std::uint32_t lookupVariable(Utility::Symbol name) {
+                auto it = variables.find(name);
+                if (it == variables.end()) {
+                    throw Utility::getError(Utility::CE, "Unknown variable '{}'", Utility::getSymbolName(name));
+                }
+                return it->second;
+            }
+
+            /// @brief Compiles body into the first register after the arguments, then returns it.
+            void compileBody(AST::ExprId body) {
+                auto result = allocate();
+                schedule(body, result, true);
+                while (!tasks.empty()) visit(program, tasks.back().id, *this);
+                emit(Opcode::Return, result);
+            }
+
+            void schedule(AST::ExprId id, std::uint32_t dest, bool tail = false) {
+                tasks.push_back({id, 0, dest, top});
+                tasks.back().tail = tail;
+            }
+
+            /// @param dest Register to compile the node into, or unbound for a new one
+            ///
+            /// @return The register holding the value of an operand once it is compiled, which is the register of
+            /// the variable itself for variables
+            std::uint32_t getOperand(AST::ExprId id, std::uint32_t dest = unbound) {
+                if (id.kind() == AST::ExprKind::Variable) {
+                    return lookupVariable(program.get<AST::VariableExpr>(id).name);
+                }
+                return dest == unbound ? allocate() : dest;
+            }
+
+            /// @brief Schedules an operand to be compiled into the register returned by getOperand().
+            void scheduleOperand(AST::ExprId id, std::uint32_t reg) {
+                if (id.kind() != AST::ExprKind::Variable) schedule(id, reg);
+            }
+
+            /// @brief Ends the current task, freeing its registers.
+            void finish() {
+                top = tasks.back().mark;
+                tasks.pop_back();
+            }
+
+            void operator()(const AST::NumberExpr &expr) {
+                loadConstant(tasks.back().dest, expr.value);
+                finish();
+            }
+
+            void operator()(const AST::VariableExpr &expr) {
+                auto reg = lookupVariable(expr.name);
+                if (reg != tasks.back().dest) emit(Opcode::Move, tasks.back().dest, reg);
+                finish();
+            }
+
+            void operator()(const AST::BinaryExpr &expr) {
+                auto &task = tasks.back();
+                auto &[lhs, rhs, unused0, unused1] = task.saved;
+                switch (task.stage++) {
+                    case 0:
+                        // dest is free until the node finishes
+                        lhs = getOperand(expr.lhs, task.dest);
+                        return scheduleOperand(expr.lhs, lhs);
+                    case 1:
+                        rhs = getOperand(expr.rhs);
+                        return scheduleOperand(expr.rhs, rhs);
+                    default:
+                        break;
+                }
+
+                switch (expr.op) {
+                    case AST::Operator::Add:
+                        emit(Opcode::Add, task.dest, lhs, rhs);
+                        break;
+                    case AST::Operator::Sub:
+                        emit(Opcode::Sub, task.dest, lhs, rhs);
+                        break;
+                    case AST::Operator::Mul:
+                        emit(Opcode::Mul, task.dest, lhs, rhs);
+                        break;
+                    case AST::Operator::Div:
+                        emit(Opcode::Div, task.dest, lhs, rhs);
+                        break;
+                    case AST::Operator::Equ:
+                        emit(Opcode::Equ, task.dest, lhs, rhs);
+                        break;
+                    case AST::Operator::Lt:
+                        emit(Opcode::Lt, task.dest, lhs, rhs);
+                        break;
+                    default:
+                        throw Utility::getError(Utility::CE, "Invalid binary operator, found '{}'", (int) expr.op);
+                }
+                finish();
+            }
+
+            void operator()(const AST::CallExpr &expr) {
+                auto &task = tasks.back();
+                auto &[index, base, unused0, unused1] = task.saved;
+                if (task.stage == 0) {
+                    auto it = module.indices.find(expr.callee);
+                    if (it == module.indices.end()) {
+                        throw Utility::getError(Utility::CE, "Unknown function '{}'",
+                                                Utility::getSymbolName(expr.callee));
+                    }
+                    index = it->second;
+
+                    auto arity = module.functions[index].arity;
+                    if (arity != expr.argCount) {
+                        throw Utility::getError(Utility::CE, "Function '{}' requires {} arguments, given {}",
+                                                Utility::getSymbolName(expr.callee), arity, expr.argCount);
+                    }
+
+                    // Arguments are evaluated right where the frame of the callee starts, which is dest itself if
+                    // nothing is allocated above it
+                    if (task.dest + 1 == top) {
+                        base = task.dest;
+                        allocate(std::max(expr.argCount, 1u) - 1);
+                    } else {
+                        base = allocate(std::max(expr.argCount, 1u));
+                    }
+                }
+
+                // One argument per stage
+                if (task.stage < expr.argCount) {
+                    auto stage = task.stage++;
+                    return schedule(program.getArgs(expr)[stage], base + stage);
+                }
+
+                // A tail call never comes back, so recursion in tail position runs in constant space
+                if (task.tail) {
+                    emitWide(Opcode::TailCall, base, index);
+                    return finish();
+                }
+                emitWide(Opcode::Call, base, index);
+                if (base != task.dest) emit(Opcode::Move, task.dest, base);
+                finish();
+            }
+
+            void operator()(const AST::IfExpr &expr) {
+                auto &task = tasks.back();
+                auto &[condition, jump, unused0, unused1] = task.saved;
+                switch (task.stage++) {
+                    case 0:
+                        condition = getOperand(expr.condition_clause, task.dest);
+                        return scheduleOperand(expr.condition_clause, condition);
+
+                    case 1:
+                        jump = here();
+                        emitWide(Opcode::JumpIfFalse, condition, 0);
+                        return schedule(expr.then_clause, task.dest, task.tail);
+
+                    case 2: {
+                        auto skip = here();
+                        emitWide(Opcode::Jump, 0, 0);
+                        patch(jump);
+                        jump = skip;
+                        return schedule(expr.else_clause, task.dest, task.tail);
+                    }
+
+                    default:
+                        break;
+                }
+                patch(jump);
+                finish();
+            }
+
+            void operator()(const AST::ForExpr &expr) {
+                // The next value of the loop variable is in the register after it
+                auto &task = tasks.back();
+                auto &[variable, loop, existing, operand] = task.saved;
+                switch (task.stage++) {
+                    case 0:
+                        variable = allocate();
+                        return schedule(expr.start, variable);
+
+                    case 1: {
+                        // Bind the loop variable, saving the existing one if any
+                        auto it = variables.find(expr.varName);
+                        existing = it == variables.end() ? unbound : it->second;
+                        variables[expr.varName] = variable;
+
+                        // The value of the body is not needed
+                        loop = here();
+                        return schedule(expr.body, allocate());
+                    }
+
+                    case 2:
+                        top = variable + 1;
+                        allocate();
+
+                        // If there isn't a step (since it's optional), it is 1
+                        if (expr.step) {
+                            operand = getOperand(expr.step);
+                            return scheduleOperand(expr.step, operand);
+                        }
+                        operand = allocate();
+                        return loadConstant(operand, 1.0);
+
+                    case 3:
+                        // The end condition still sees the current value
+                        emit(Opcode::Add, variable + 1, variable, operand);
+                        operand = getOperand(expr.end);
+                        return scheduleOperand(expr.end, operand);
+
+                    default:
+                        break;
+                }
+                emit(Opcode::Move, variable, variable + 1);
+                emitWide(Opcode::JumpIfTrue, operand, loop);
+
+                // Restore existing variable saved earlier
+                if (existing != unbound) variables[expr.varName] = existing;
+                else variables.erase(expr.varName);
+
+                // The value of a for-loop is 0
+                loadConstant(task.dest, 0.0);
+                finish();
+            }
+
+            void operator()(const AST::Prototype &) {
+                throw Utility::getError(Utility::CE, "Prototypes are only allowed as externs");
+            }
+
+            void operator()(const AST::Function &) {
+                throw Utility::getError(Utility::CE, "Functions are only allowed at the top level");
+            }
+        };
+
+        /// @return The index of a function in module, adding it if it was never declared
+        std::uint32_t declare(BytecodeModule &module, Utility::Symbol name, std::uint32_t arity) {
+            auto it = module.indices.find(name);
+            if (it != module.indices.end()) {
+                auto &function = module.functions[it->second];
+                if (function.arity != arity) {
+                    throw Utility::getError(Utility::CE, "Function '{}' requires {} arguments, given {}",
+                                            Utility::getSymbolName(name), function.arity, arity);
+                }
+                return it->second;
+            }
+
+            auto index = (std::uint32_t) module.functions.size();
+            module.functions.push_back({name, arity});
+            module.indices.emplace(name, index);
+            return index;
+        }
+    }
+
+    std::optional<BytecodeFunction> compileBytecode(BytecodeModule &module, const AST::Program &program,
+                                                    AST::ExprId stmt) {
+        if (stmt.kind() == AST::ExprKind::Prototype) {
+            const auto &proto = program.get<AST::Prototype>(stmt);
+            declare(module, proto.name, proto.argCount);
+            return std::nullopt;
+        }
+
+        // A top-level expression is the body of a function without arguments
+        BytecodeCompiler compiler{module, program};
+        if (stmt.kind() != AST::ExprKind::Function) {
+            compiler.compileBody(stmt);
+            return std::move(compiler.function);
+        }
+
+        const auto &function = program.get<AST::Function>(stmt);
+        const auto &proto = program.get<AST::Prototype>(function.proto);
+        auto declared = module.indices.count(proto.name) != 0;
+        auto index = declare(module, proto.name, proto.argCount);
+        if (!module.functions[index].code.empty()) {
+            throw Utility::getError(Utility::CE, "Function '{}' cannot be redefined",
+                                    Utility::getSymbolName(proto.name));
+        }
+
+        // Arguments are in the first registers
+        compiler.function.name = proto.name;
+        compiler.function.arity = proto.argCount;
+        for (auto arg: program.getArgs(proto)) compiler.variables[arg] = compiler.allocate();
+        try {
+            compiler.compileBody(function.body);
+        } catch (...) {
+            // A function that was declared before keeps its declaration
+            if (!declared) {
+                module.functions.pop_back();
+                module.indices.erase(proto.name);
+            }
+            throw;
+        }
+
+        module.functions[index] = std::move(compiler.function);
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,246 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Firestorm::Backend {
+    namespace {
+        /// @brief Changes whenever the code generated for the same AST changes, e.g. with new optimisations
+        constexpr const char *formatVersion = "firestorm-cache-1";
+
+        /// @brief Prefix of the identifiers of modules marked with CompileCache::setKey()
+        constexpr llvm::StringLiteral keyPrefix = "firestorm-cache:";
+
+        /// @brief Hashes a sequence of fields, each of which is delimited, so that no two sequences hash the same
+        /// bytes.
+        struct Hasher {
+            llvm::SHA1 sha;
+
+            void add(llvm::StringRef data) {
+                add((std::uint64_t) data.size());
+                sha.update(data);
+            }
+
+            void add(std::uint64_t value) {
+                std::uint8_t bytes[sizeof value];
+                for (auto &byte: bytes) {
+                    byte = (std::uint8_t) value;
+                    value >>= 8;
+                }
+                sha.update(bytes);
+            }
+
+            void add(double value) {
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof bits);
+                add(bits);
+            }
+
+            void add(Utility::Symbol symbol) {
+                auto name = Utility::getSymbolName(symbol);
+                add(llvm::StringRef(name.data(), name.size()));
+            }
+
+            std::string finish() {
+                return llvm::toHex(sha.final(), true);
+            }
+        };
+
+        /// @return The name that a statement defines or declares, or nothing for top-level expressions
+        std::optional<Utility::Symbol> getDeclaredName(const AST::Program &program, AST::ExprId stmt) {
+            if (stmt.kind() == AST::ExprKind::Function) stmt = program.get<AST::Function>(stmt).proto;
+            if (stmt.kind() != AST::ExprKind::Prototype) return std::nullopt;
+            return program.get<AST::Prototype>(stmt).name;
+        }
+    }
+
+    CompileCache::CompileCache(std::string directory, const AST::OptimiserOptions &options)
+            : directory(std::move(directory)), profile(options.profile.use) {
+        // Failures show when entries are stored, which are then ignored
+        llvm::sys::fs::create_directories(this->directory);
+
+        Hasher hasher;
+        hasher.add(formatVersion);
+        hasher.add(LLVM_VERSION_STRING);
+
+        // Code is compiled for the host, with everything its CPU supports
+        hasher.add(llvm::sys::getProcessTriple());
+        hasher.add(llvm::sys::getHostCPUName());
+        llvm::StringMap<bool> hostFeatures;
+        std::vector<std::string> features;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+            for (auto &feature: hostFeatures) features.push_back((feature.second ? "+" : "-") + feature.first().str());
+        }
+        std::sort(features.begin(), features.end());
+        for (auto &feature: features) hasher.add(feature);
+
+        hasher.add((std::uint64_t) options.level);
+        hasher.add(options.extraPasses);
+        hasher.add((std::uint64_t) options.fastMath);
+        hasher.add((std::uint64_t) options.memo.automatic);
+        hasher.add(options.memo.budget);
+        hasher.add((std::uint64_t) options.memo.stats);
+
+        // The path of the profile is not part of the code, only whether functions count into it
+        hasher.add((std::uint64_t) !options.profile.generate.empty());
+        base = hasher.finish();
+    }
+
+    std::string CompileCache::getPath(llvm::StringRef key, llvm::StringRef extension) const {
+        llvm::SmallString<128> path(directory);
+        llvm::sys::path::append(path, key + "." + extension);
+        return std::string(path);
+    }
+
+    std::string CompileCache::getKey(const AST::Program &program, AST::ExprId stmt) {
+        Hasher hasher;
+        hasher.add(base);
+        auto name = getDeclaredName(program, stmt);
+
+        // Nodes are hashed in pre-order, each with the number of its children, so that the order determines the tree
+        std::vector<AST::ExprId> nodes{stmt};
+        while (!nodes.empty()) {
+            auto id = nodes.back();
+            nodes.pop_back();
+            if (!id) {
+                // An omitted step of a for-loop
+                hasher.add(std::uint64_t(-1));
+                continue;
+            }
+
+            hasher.add((std::uint64_t) id.kind());
+            switch (id.kind()) {
+                case AST::ExprKind::Number:
+                    hasher.add(program.get<AST::NumberExpr>(id).value);
+                    break;
+
+                case AST::ExprKind::Variable:
+                    hasher.add(program.get<AST::VariableExpr>(id).name);
+                    break;
+
+                case AST::ExprKind::Binary:
+                    hasher.add((std::uint64_t) program.get<AST::BinaryExpr>(id).op);
+                    break;
+
+                case AST::ExprKind::Call: {
+                    // The code of a call depends on the callee too, e.g. when it is inlined or memoized, so it
+                    // changes whenever the callee does
+                    auto callee = program.get<AST::CallExpr>(id).callee;
+                    hasher.add(callee);
+                    auto it = functions.find(callee);
+                    if (callee == name) hasher.add("recursive");
+                    else if (it != functions.end()) hasher.add(it->second);
+                    else hasher.add("undeclared");
+                    break;
+                }
+
+                case AST::ExprKind::For:
+                    hasher.add(program.get<AST::ForExpr>(id).varName);
+                    break;
+
+                case AST::ExprKind::Prototype: {
+                    const auto &proto = program.get<AST::Prototype>(id);
+                    hasher.add(proto.name);
+                    hasher.add((std::uint64_t) proto.argCount);
+                    for (auto param: program.getArgs(proto)) hasher.add(param);
+                    break;
+                }
+
+                case AST::ExprKind::Function: {
+                    const auto &function = program.get<AST::Function>(id);
+                    hasher.add((std::uint64_t) function.fastMath);
+                    hasher.add((std::uint64_t) function.memoize);
+                    nodes.push_back(function.body);
+                    nodes.push_back(function.proto);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+
+            auto count = AST::countChildren(program, id);
+            hasher.add((std::uint64_t) count);
+            for (auto i = count; i > 0; --i) nodes.push_back(AST::getChild(program, id, i - 1));
+        }
+
+        // Definitions are optimised with their counters, and functions without any as cold ones
+        if (profile && stmt.kind() == AST::ExprKind::Function) {
+            auto counters = profile->functions.find(std::string(Utility::getSymbolName(*name)));
+            if (counters != profile->functions.end()) {
+                hasher.add((std::uint64_t) counters->second.size());
+                for (auto counter: counters->second) hasher.add(counter);
+            }
+            hasher.add(profile->maxCalls);
+        }
+
+        auto key = hasher.finish();
+        if (name) functions[*name] = key;
+        return key;
+    }
+
+    std::string CompileCache::getProgramKey(const std::vector<std::string> &statements,
+                                            llvm::StringRef entryPoint) const {
+        Hasher hasher;
+        hasher.add(base);
+        hasher.add("program");
+        for (auto &statement: statements) hasher.add(statement);
+        hasher.add(entryPoint);
+        return hasher.finish();
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> CompileCache::load(llvm::StringRef key, llvm::StringRef extension) const {
+        auto buffer = llvm::MemoryBuffer::getFile(getPath(key, extension));
+        return buffer ? std::move(*buffer) : nullptr;
+    }
+
+    void CompileCache::store(llvm::StringRef key, llvm::StringRef extension, llvm::StringRef data) const {
+        auto path = getPath(key, extension);
+        llvm::SmallString<128> temporary;
+        int fd;
+        if (llvm::sys::fs::createUniqueFile(path + "-%%%%%%.tmp", fd, temporary)) return;
+        {
+            llvm::raw_fd_ostream out(fd, true);
+            out << data;
+            out.close();
+            if (out.has_error()) {
+                out.clear_error();
+                llvm::sys::fs::remove(temporary);
+                return;
+            }
+        }
+
+        // Another process may have stored the same entry meanwhile, which is replaced by an identical one
+        if (llvm::sys::fs::rename(temporary, path)) llvm::sys::fs::remove(temporary);
+    }
+
+    void CompileCache::setKey(llvm::Module &module, llvm::StringRef key) {
+        module.setModuleIdentifier((keyPrefix + key).str());
+    }
+
+    void CompileCache::notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) {
+        llvm::StringRef identifier = module->getModuleIdentifier();
+        if (identifier.consume_front(keyPrefix)) store(identifier, "o", object.getBuffer());
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> CompileCache::getObject(const llvm::Module *module) {
+        llvm::StringRef identifier = module->getModuleIdentifier();
+        if (!identifier.consume_front(keyPrefix)) return nullptr;
+        return load(identifier, "o");
+    }
+}
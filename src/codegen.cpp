@@ -1,30 +1,919 @@
 //
 // Created by Nguyen Thai Binh on 18/1/22.
 //
-#include <llvm/Transforms/Scalar/GVN.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include "Firestorm/codegen.hpp"
+#include "Firestorm/custom_exceptions.hpp"
 
 namespace Firestorm::AST {
+    namespace {
+        /// @brief Instructions of an optimised function at most for its body to be imported into other modules
+        constexpr unsigned maxInlineableSize = 64;
 
-    CodeGenerator::CodeGenerator() : context(), builder(context), module("Main", context),
-                                     optimiser(module) {}
+        /// @brief Imports the recorded bodies of the functions that the current module of codegen declares.
+        ///
+        /// @note Only the functions it calls directly are imported, not the functions that those call.
+        void importBodies(CodeGenerator &codegen) {
+            auto &module = *codegen.module;
+            std::vector<llvm::StringRef> names;
+            for (auto &func: module) {
+                if (!func.isDeclaration()) continue;
+                if (codegen.inlineableBodies.count(Utility::internSymbol(func.getName()))) {
+                    names.push_back(func.getName());
+                }
+            }
+            if (names.empty()) return;
 
-    Optimiser::Optimiser(llvm::Module &m) : passManager(&m) {
-        // Do simple "peephole" optimizations and bit-twiddling options.
-        passManager.add(llvm::createInstructionCombiningPass());
+            llvm::Linker linker(module);
+            for (auto name: names) {
+                const auto &bitcode = codegen.inlineableBodies.at(Utility::internSymbol(name));
+                auto source = llvm::parseBitcodeFile(
+                        llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()), name),
+                        *codegen.context);
+                if (!source) {
+                    throw Utility::getError(Utility::BE, "Cannot read the body of '{}': {}", name.str(),
+                                            llvm::toString(source.takeError()));
+                }
 
-        // Re-associate expressions.
-        passManager.add(llvm::createReassociatePass());
+                // Its code stays in its own module, so that the body is only there to be inlined
+                (*source)->getFunction(name)->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+                if (linker.linkInModule(std::move(*source))) {
+                    throw Utility::getError(Utility::BE, "Cannot import the body of '{}'", name.str());
+                }
+            }
+        }
 
-        // Eliminate Common SubExpressions.
-        passManager.add(llvm::createGVNPass());
+        /// @brief Records the body of the function defined by the current module of codegen, if it is small
+        /// enough to be imported into later modules.
+        void recordBody(CodeGenerator &codegen) {
+            auto &module = *codegen.module;
 
-        // Simplify the control flow graph (deleting unreachable blocks, etc).
-        passManager.add(llvm::createCFGSimplificationPass());
+            // Memoized functions own the globals of their caches, which must not be defined twice
+            if (!module.global_empty()) return;
 
-        passManager.doInitialization();
+            llvm::Function *defined = nullptr;
+            for (auto &func: module) {
+                if (func.isDeclaration()) continue;
+                if (defined || func.hasLocalLinkage()) return;
+                defined = &func;
+            }
+            if (!defined || defined->getInstructionCount() > maxInlineableSize) return;
+
+            auto &bitcode = codegen.inlineableBodies[Utility::internSymbol(defined->getName())];
+            llvm::raw_svector_ostream out(bitcode);
+            llvm::WriteBitcodeToFile(module, out);
+        }
+    }
+
+    CodeGenerator::CodeGenerator(const OptimiserOptions &options) {
+        setOptimiserOptions(options);
+        startModule("Main");
+    }
+
+    void CodeGenerator::setOptimiserOptions(const OptimiserOptions &options) {
+        optimiser = std::make_unique<Optimiser>(options);
+        inlineAcrossModules = options.level != OptimisationLevel::O0;
+        fastMath = options.fastMath;
+        memo = options.memo;
+        profile = options.profile;
+    }
+
+    void CodeGenerator::startModule(const std::string &name) {
+        // The builder and the module refer to the context
+        builder.reset();
+        module.reset();
+
+        context = std::make_unique<llvm::LLVMContext>();
+        builder = std::make_unique<llvm::IRBuilder<>>(*context);
+        module = std::make_unique<llvm::Module>(name, *context);
+
+        // Functions of the previous module are declared again when called
+        functions.clear();
+        namedValues.clear();
+    }
+
+    llvm::orc::ThreadSafeModule CodeGenerator::takeModule() {
+        if (inlineAcrossModules) importBodies(*this);
+        optimiser->run(*module);
+        if (inlineAcrossModules) recordBody(*this);
+        builder.reset();
+        llvm::orc::ThreadSafeModule result(std::move(module), std::move(context));
+        startModule("Main");
+        return result;
+    }
+
+    llvm::Function *CodeGenerator::getFunction(Utility::Symbol name) {
+        // Check for the function in the current module
+        auto it = functions.find(name);
+        if (it != functions.end()) return it->second;
+
+        // Otherwise, check for a function declared in an earlier module
+        auto signature = signatures.find(name);
+        if (signature == signatures.end()) return nullptr;
+
+        auto &parameters = signature->second.parameters;
+        std::vector<llvm::Type *> args_type{parameters.size(), llvm::Type::getDoubleTy(*context)};
+        auto func_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(*context), args_type, false);
+        auto func = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
+                                           Utility::getSymbolName(name), *module);
+        unsigned idx = 0;
+        for (auto &arg: func->args()) {
+            arg.setName(Utility::getSymbolName(parameters[idx++]));
+        }
+        return functions[name] = func;
+    }
+
+    namespace {
+        /// @brief Sets fast-math flags of AST::FastMath on a function, for its instructions generated later by
+        /// builder, and as attributes for the backend, like Clang's -ffast-math.
+        void setFastMathFlags(llvm::Function &func, llvm::IRBuilder<> &builder, std::uint8_t flags) {
+            llvm::FastMathFlags llvmFlags;
+            llvmFlags.setAllowReassoc(flags & FastMath::Reassoc);
+            llvmFlags.setNoNaNs(flags & FastMath::NoNaNs);
+            llvmFlags.setNoInfs(flags & FastMath::NoInfs);
+            llvmFlags.setNoSignedZeros(flags & FastMath::NoSignedZeros);
+            llvmFlags.setAllowReciprocal(flags & FastMath::AllowReciprocal);
+            llvmFlags.setAllowContract(flags & FastMath::AllowContract);
+            llvmFlags.setApproxFunc(flags & FastMath::ApproxFunc);
+            builder.setFastMathFlags(llvmFlags);
+            if (!flags) return;
+
+            if (flags & FastMath::NoNaNs) func.addFnAttr("no-nans-fp-math", "true");
+            if (flags & FastMath::NoInfs) func.addFnAttr("no-infs-fp-math", "true");
+            if (flags & FastMath::NoSignedZeros) func.addFnAttr("no-signed-zeros-fp-math", "true");
+            if (flags & FastMath::ApproxFunc) func.addFnAttr("approx-func-fp-math", "true");
+            if (flags == FastMath::Fast) func.addFnAttr("unsafe-fp-math", "true");
+        }
+
+        /// @return The number of calls of a definition to itself
+        std::uint32_t countRecursiveCalls(const Program &program, ExprId function) {
+            const auto &func = program.get<Function>(function);
+            auto name = program.get<Prototype>(func.proto).name;
+            std::uint32_t count = 0;
+            std::vector<ExprId> pending{func.body};
+            while (!pending.empty()) {
+                auto id = pending.back();
+                pending.pop_back();
+                if (id.kind() == ExprKind::Call && program.get<CallExpr>(id).callee == name) ++count;
+                for (std::uint32_t i = 0; i < countChildren(program, id); ++i) {
+                    if (auto child = getChild(program, id, i)) pending.push_back(child);
+                }
+            }
+            return count;
+        }
+
+        /// @brief Makes a function look its arguments up in a cache of its values before running its body, and
+        /// store the value it returns there.
+        ///
+        /// @note The cache is a direct-mapped table, keyed on the bit patterns of the arguments, with as many
+        /// entries as fit in options.budget. A colliding entry is overwritten. With options.stats, hits and misses
+        /// are counted, and registered with the runtime on the first miss.
+        ///
+        /// @note Globals are named after the function, so that they can be shared with code recompiled from it.
+        ///
+        /// @param func A complete function, with a single return
+        void memoize(llvm::Function &func, const MemoOptions &options) {
+            auto &context = func.getContext();
+            auto &module = *func.getParent();
+            auto name = func.getName().str();
+            llvm::IRBuilder<> builder(context);
+            auto int64 = builder.getInt64Ty();
+            auto int8 = builder.getInt8Ty();
+
+            // Entries are {keys, value, valid}, as many as fit in the budget, rounded down to a power of 2
+            auto arity = (std::uint32_t) func.arg_size();
+            auto entryType = llvm::StructType::get(
+                    context, {llvm::ArrayType::get(int64, arity), builder.getDoubleTy(), int8});
+            std::uint64_t entrySize = 8 * arity + 16;
+            unsigned bits = 0;
+            while (bits < 32 && (entrySize << (bits + 1)) <= options.budget) ++bits;
+            auto tableType = llvm::ArrayType::get(entryType, std::uint64_t(1) << bits);
+            auto table = new llvm::GlobalVariable(module, tableType, false, llvm::GlobalValue::ExternalLinkage,
+                                                  llvm::ConstantAggregateZero::get(tableType), name + ".memo");
+
+            // Layout of FirestormMemoStats of the runtime
+            llvm::GlobalVariable *stats = nullptr;
+            llvm::StructType *statsType = nullptr;
+            if (options.stats) {
+                statsType = llvm::StructType::get(
+                        context, {builder.getInt8PtrTy(), int64, int64, builder.getInt8PtrTy()});
+                auto init = llvm::ConstantStruct::get(
+                        statsType, {builder.CreateGlobalStringPtr(name, name + ".memo.name", 0, &module),
+                                    builder.getInt64(0), builder.getInt64(0),
+                                    llvm::ConstantPointerNull::get(builder.getInt8PtrTy())});
+                stats = new llvm::GlobalVariable(module, statsType, false, llvm::GlobalValue::ExternalLinkage,
+                                                 init, name + ".memo.stats");
+            }
+            auto increment = [&](unsigned field) {
+                auto counter = builder.CreateStructGEP(statsType, stats, field);
+                auto count = builder.CreateLoad(int64, counter);
+                builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)), counter);
+                return count;
+            };
+
+            auto body = &func.getEntryBlock();
+            llvm::ReturnInst *ret = nullptr;
+            for (auto &block: func) {
+                if (auto inst = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) ret = inst;
+            }
+            auto lookup = llvm::BasicBlock::Create(context, "memo_lookup", &func, body);
+            auto hit = llvm::BasicBlock::Create(context, "memo_hit", &func, body);
+
+            // Hash the bit patterns of the arguments
+            builder.SetInsertPoint(lookup);
+            llvm::Value *hash = builder.getInt64(0);
+            std::vector<llvm::Value *> keys;
+            for (auto &arg: func.args()) {
+                keys.push_back(builder.CreateBitCast(&arg, int64));
+                hash = builder.CreateMul(builder.CreateXor(hash, keys.back()), builder.getInt64(0x9E3779B97F4A7C15));
+            }
+            auto index = bits ? builder.CreateLShr(hash, 64 - bits) : builder.getInt64(0);
+            auto entry = builder.CreateInBoundsGEP(tableType, table, {builder.getInt64(0), index});
+            auto field = [&](std::vector<unsigned> indices) {
+                std::vector<llvm::Value *> values{builder.getInt32(0)};
+                for (auto i: indices) values.push_back(builder.getInt32(i));
+                return builder.CreateInBoundsGEP(entryType, entry, values);
+            };
+
+            // A hit needs a valid entry with the same keys
+            llvm::Value *found = builder.CreateICmpNE(builder.CreateLoad(int8, field({2})), builder.getInt8(0));
+            for (unsigned i = 0; i < arity; ++i) {
+                auto key = builder.CreateLoad(int64, field({0, i}));
+                found = builder.CreateAnd(found, builder.CreateICmpEQ(key, keys[i]));
+            }
+            builder.CreateCondBr(found, hit, body);
+
+            builder.SetInsertPoint(hit);
+            if (stats) increment(1);
+            builder.CreateRet(builder.CreateLoad(builder.getDoubleTy(), field({1})));
+
+            // A miss stores the value before returning it
+            builder.SetInsertPoint(ret);
+            for (unsigned i = 0; i < arity; ++i) builder.CreateStore(keys[i], field({0, i}));
+            builder.CreateStore(ret->getReturnValue(), field({1}));
+            builder.CreateStore(builder.getInt8(1), field({2}));
+            if (!stats) return;
+
+            auto store = ret->getParent();
+            auto done = store->splitBasicBlock(ret, "memo_done");
+            auto registration = llvm::BasicBlock::Create(context, "memo_register", &func, done);
+            store->getTerminator()->eraseFromParent();
+            builder.SetInsertPoint(store);
+            auto first = builder.CreateICmpEQ(increment(2), builder.getInt64(0));
+            builder.CreateCondBr(first, registration, done);
+
+            builder.SetInsertPoint(registration);
+            auto type = llvm::FunctionType::get(builder.getVoidTy(), {builder.getInt8PtrTy()}, false);
+            auto callee = module.getOrInsertFunction("firestorm_register_memo", type);
+            builder.CreateCall(callee, {builder.CreateBitCast(stats, builder.getInt8PtrTy())});
+            builder.CreateBr(done);
+        }
+
+        /// @brief Makes a function count its calls, and register its counters with the runtime on its first call.
+        ///
+        /// @note Globals are named after the function, so that they can be shared with code recompiled from it.
+        ///
+        /// @param counters Stand-in for the counters, which the body counts its branches in, replaced here
+        ///
+        /// @param count Number of counters, the first of which counts calls
+        void instrument(llvm::Function &func, llvm::GlobalVariable *counters, std::uint32_t count) {
+            auto &context = func.getContext();
+            auto &module = *func.getParent();
+            auto name = func.getName().str();
+            llvm::IRBuilder<> builder(context);
+            auto int64 = builder.getInt64Ty();
+
+            auto arrayType = llvm::ArrayType::get(int64, count);
+            auto array = new llvm::GlobalVariable(module, arrayType, false, llvm::GlobalValue::ExternalLinkage,
+                                                  llvm::ConstantAggregateZero::get(arrayType), name + ".prof");
+            auto calls = llvm::ConstantExpr::getBitCast(array, counters->getType());
+            counters->replaceAllUsesWith(calls);
+            counters->eraseFromParent();
+
+            // Layout of FirestormProfile of the runtime
+            auto dataType = llvm::StructType::get(
+                    context, {builder.getInt8PtrTy(), int64, int64->getPointerTo(), builder.getInt8PtrTy()});
+            auto init = llvm::ConstantStruct::get(
+                    dataType, {builder.CreateGlobalStringPtr(name, name + ".prof.name", 0, &module),
+                               builder.getInt64(count), calls, llvm::ConstantPointerNull::get(builder.getInt8PtrTy())});
+            auto data = new llvm::GlobalVariable(module, dataType, false, llvm::GlobalValue::ExternalLinkage, init,
+                                                 name + ".prof.data");
+
+            auto body = &func.getEntryBlock();
+            auto entry = llvm::BasicBlock::Create(context, "prof_entry", &func, body);
+            auto registration = llvm::BasicBlock::Create(context, "prof_register", &func, body);
+            builder.SetInsertPoint(entry);
+            auto previous = builder.CreateLoad(int64, calls);
+            builder.CreateStore(builder.CreateAdd(previous, builder.getInt64(1)), calls);
+            builder.CreateCondBr(builder.CreateICmpEQ(previous, builder.getInt64(0)), registration, body);
+
+            builder.SetInsertPoint(registration);
+            auto type = llvm::FunctionType::get(builder.getVoidTy(), {builder.getInt8PtrTy()}, false);
+            auto callee = module.getOrInsertFunction("firestorm_register_profile", type);
+            builder.CreateCall(callee, {builder.CreateBitCast(data, builder.getInt8PtrTy())});
+            builder.CreateBr(body);
+        }
+
+        /// @return Branch weights of two counts, scaled down to the 32 bits of metadata
+        llvm::MDNode *getBranchWeights(llvm::LLVMContext &context, std::uint64_t taken, std::uint64_t other) {
+            auto scale = std::max(taken, other) / UINT32_MAX + 1;
+            return llvm::MDBuilder(context).createBranchWeights((std::uint32_t) (taken / scale),
+                                                                (std::uint32_t) (other / scale));
+        }
+
+        /// @brief A conditional branch of a function, which is weighted by its counters in a profile.
+        struct ProfiledBranch {
+            llvm::BranchInst *branch;
+
+            /// @brief Index of the first of its two counters
+            std::uint32_t counter;
+
+            /// @brief Whether the branch ends a for-loop, whose counters are its iterations and its exits, rather
+            /// than how often either branch was taken
+            bool loop;
+        };
+
+        /// @brief Sets the entry count of a function, and the weights of its branches, from its counters in a
+        /// profile. Functions that were never called are cold, and those called at least a tenth as often as the
+        /// most called one are hot.
+        ///
+        /// @note Functions are only in a profile if they were called, so those that are not in it are cold. The
+        /// profile of a function is ignored if it has a different number of counters, e.g. as the function changed.
+        void applyProfile(llvm::Function &func, const Profile &profile, std::uint32_t count,
+                          const std::vector<ProfiledBranch> &branches) {
+            auto it = profile.functions.find(func.getName().str());
+            if (it == profile.functions.end()) {
+                func.setEntryCount(0);
+                func.addFnAttr(llvm::Attribute::Cold);
+                return;
+            }
+            if (it->second.size() != count) return;
+            const auto &counters = it->second;
+
+            func.setEntryCount(counters[0]);
+            if (counters[0] == 0) {
+                func.addFnAttr(llvm::Attribute::Cold);
+            } else if (counters[0] >= profile.maxCalls / 10) {
+                func.addFnAttr(llvm::Attribute::Hot);
+                func.addFnAttr(llvm::Attribute::InlineHint);
+            }
+
+            for (const auto &[branch, counter, loop]: branches) {
+                auto taken = counters[counter];
+                auto other = counters[counter + 1];
+
+                // Every iteration but the last of each run of a loop branches back
+                if (loop) taken -= std::min(taken, other);
+                if (taken || other) branch->setMetadata(llvm::LLVMContext::MD_prof,
+                                                        getBranchWeights(func.getContext(), taken, other));
+            }
+        }
+
+        /// @brief Visitor emitting LLVM IR for every kind of node.
+        ///
+        /// @note Nodes are generated without recursion, so that nesting depth is only limited by memory. Every
+        /// node is a task that runs in stages: a stage schedules at most one child, whose value is on values when
+        /// the next stage of the node runs.
+        struct IRGenerator {
+            struct Task {
+                ExprId id;
+                std::uint32_t stage = 0;
+
+                // State kept between stages
+                llvm::Function *func = nullptr;
+                llvm::BasicBlock *blocks[3]{};
+                llvm::Value *saved[2]{};
+                llvm::PHINode *variable = nullptr;
+
+                /// @brief Whether the function returns the value of the node, so that calls in it are tail calls
+                bool tail = false;
+
+                /// @brief Index of the first counter of a branch
+                std::uint32_t counter = 0;
+            };
+
+            CodeGenerator &codegen;
+            const Program &program;
+            std::vector<Task> tasks;
+            std::vector<llvm::Value *> values;
+
+            /// @brief Stand-in for the counters of the function being generated, if it is instrumented, as their
+            /// number is not known before its end
+            llvm::GlobalVariable *counters = nullptr;
+
+            /// @brief Number of counters of the function being generated, the first of which counts calls
+            std::uint32_t counterCount = 0;
+
+            /// @brief Branches of the function being generated, to weight with a profile
+            std::vector<ProfiledBranch> branches;
+
+            auto &Context() {
+                return *codegen.context;
+            }
+
+            auto &Builder() {
+                return *codegen.builder;
+            }
+
+            auto &Module() {
+                return *codegen.module;
+            }
+
+            auto &NamedValues() {
+                return codegen.namedValues;
+            }
+
+            auto &Functions() {
+                return codegen.functions;
+            }
+
+            auto &Signatures() {
+                return codegen.signatures;
+            }
+
+            auto DoubleType() {
+                // Not cached, as every module has its own context
+                return llvm::Type::getDoubleTy(Context());
+            }
+
+            llvm::Value *Number(double value) {
+                return llvm::ConstantFP::get(Context(), llvm::APFloat(value));
+            }
+
+            llvm::Value *generate(ExprId id) {
+                auto base = tasks.size();
+                auto valueBase = values.size();
+                schedule(id);
+                try {
+                    while (tasks.size() > base) visit(program, tasks.back().id, *this);
+                } catch (...) {
+                    abandon(base);
+                    values.resize(valueBase);
+                    throw;
+                }
+                auto value = values.back();
+                values.pop_back();
+                return value;
+            }
+
+            void schedule(ExprId id, bool tail = false) {
+                tasks.push_back({id});
+                tasks.back().tail = tail;
+            }
+
+            /// @brief Ends the current task, with value as its result.
+            void finish(llvm::Value *value) {
+                tasks.pop_back();
+                values.push_back(value);
+            }
+
+            llvm::Value *pop() {
+                auto value = values.back();
+                values.pop_back();
+                return value;
+            }
+
+            /// @return The index of the first of two new counters of a branch
+            std::uint32_t addCounters() {
+                counterCount += 2;
+                return counterCount - 2;
+            }
+
+            /// @brief Increments a counter at the insert point, if the function is instrumented.
+            void count(std::uint32_t counter) {
+                if (!counters) return;
+                auto int64 = Builder().getInt64Ty();
+                auto address = Builder().CreateConstInBoundsGEP1_64(int64, counters, counter);
+                Builder().CreateStore(Builder().CreateAdd(Builder().CreateLoad(int64, address), Builder().getInt64(1)),
+                                      address);
+            }
+
+            /// @brief Drops the tasks above base after a failure, removing the functions they were defining.
+            ///
+            /// @note This solves problems when functions are typed incorrectly in interpreter mode,
+            /// allowing them to be redefined.
+            void abandon(std::size_t base) {
+                for (auto i = base; i < tasks.size(); ++i) {
+                    auto func = tasks[i].func;
+                    if (tasks[i].id.kind() != ExprKind::Function || !func) continue;
+
+                    // A function that was declared before keeps its declaration
+                    func->deleteBody();
+                    if (!tasks[i].saved[0]) {
+                        const auto &function = program.get<Function>(tasks[i].id);
+                        auto name = program.get<Prototype>(function.proto).name;
+                        Functions().erase(name);
+                        Signatures().erase(name);
+                        func->eraseFromParent();
+                    }
+                }
+                tasks.resize(base);
+                if (counters) {
+                    counters->eraseFromParent();
+                    counters = nullptr;
+                }
+
+                // The insert point may have been in a removed block
+                Builder().ClearInsertionPoint();
+            }
+
+            void operator()(const NumberExpr &expr) {
+                finish(Number(expr.value));
+            }
+
+            void operator()(const VariableExpr &expr) {
+                // Look up if variable declared
+                auto it = NamedValues().find(expr.name);
+                if (it == NamedValues().end() || !it->second) {
+                    throw Utility::getError(Utility::CE, "Unknown variable '{}'", Utility::getSymbolName(expr.name));
+                }
+                finish(it->second);
+            }
+
+            void operator()(const BinaryExpr &expr) {
+                auto &task = tasks.back();
+                switch (task.stage++) {
+                    case 0:
+                        return schedule(expr.lhs);
+                    case 1:
+                        return schedule(expr.rhs);
+                    default:
+                        break;
+                }
+
+                auto rhs_code = pop();
+                auto lhs_code = pop();
+                switch (expr.op) {
+                    case Operator::Add:
+                        return finish(Builder().CreateFAdd(lhs_code, rhs_code, "add_tmp"));
+                    case Operator::Sub:
+                        return finish(Builder().CreateFSub(lhs_code, rhs_code, "sub_tmp"));
+                    case Operator::Mul:
+                        return finish(Builder().CreateFMul(lhs_code, rhs_code, "mul_tmp"));
+                    case Operator::Div:
+                        return finish(Builder().CreateFDiv(lhs_code, rhs_code, "div_tmp"));
+                    case Operator::Equ:
+                        lhs_code = Builder().CreateFCmpOEQ(lhs_code, rhs_code, "cmp_eq_tmp");
+                        return finish(Builder().CreateUIToFP(lhs_code, DoubleType(), "bool_tmp"));
+                    case Operator::Lt:
+                        lhs_code = Builder().CreateFCmpULT(lhs_code, rhs_code, "cmp_lt_tmp");
+                        return finish(Builder().CreateUIToFP(lhs_code, DoubleType(), "bool_tmp"));
+                }
+                throw Utility::getError(Utility::CE, "Invalid binary operator, found '{}'", (int) expr.op);
+            }
+
+            void operator()(const CallExpr &expr) {
+                auto &task = tasks.back();
+                if (task.stage == 0) {
+                    // Look up function
+                    task.func = codegen.getFunction(expr.callee);
+                    if (!task.func) {
+                        throw Utility::getError(Utility::CE, "Unknown function '{}'",
+                                                Utility::getSymbolName(expr.callee));
+                    }
+
+                    // Check for argument mismatch
+                    auto a = task.func->arg_size();
+                    auto b = expr.argCount;
+                    if (a != b) {
+                        throw Utility::getError(Utility::CE, "Function '{}' requires {} arguments, given {}",
+                                                Utility::getSymbolName(expr.callee), a, b);
+                    }
+                }
+
+                // Codegen for args, one per stage
+                if (task.stage < expr.argCount) {
+                    return schedule(program.getArgs(expr)[task.stage++]);
+                }
+
+                std::vector<llvm::Value *> args_code(values.end() - expr.argCount, values.end());
+                values.resize(values.size() - expr.argCount);
+                auto call = Builder().CreateCall(task.func, args_code);
+
+                // Nothing of the caller is used after a call in tail position, so the backend can jump to the
+                // callee, and tail call elimination can turn recursion into a loop
+                call->setTailCall(task.tail);
+                finish(call);
+            }
+
+            void operator()(const Prototype &proto) {
+                finish(generatePrototype(proto));
+            }
+
+            llvm::Function *generatePrototype(const Prototype &proto) {
+                auto args = program.getArgs(proto);
+
+                // Make argument types
+                // Firestorm only supports values that are doubles
+                // Hence, arguments of all proto has the form (double, ...)
+                std::vector<llvm::Type *> args_type{args.size(), DoubleType()};
+
+                // Make function type here
+                // Similarly, the return type is double
+                auto func_type = llvm::FunctionType::get(DoubleType(), args_type, false);
+
+                auto func = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
+                                                   Utility::getSymbolName(proto.name), Module());
+                Functions()[proto.name] = func;
+                Signatures()[proto.name].parameters.assign(args.begin(), args.end());
+
+                // Set names for easy reference
+                unsigned idx = 0;
+                for (auto &arg: func->args()) {
+                    arg.setName(Utility::getSymbolName(args[idx++]));
+                }
+                return func;
+            }
+
+            void operator()(const Function &function) {
+                auto &task = tasks.back();
+                if (task.stage++ == 0) {
+                    const auto &proto = program.get<Prototype>(function.proto);
+
+                    // Check for existing function, in this or an earlier module
+                    auto func = codegen.getFunction(proto.name);
+
+                    // Remember whether it was declared before, so that a failed definition keeps the declaration
+                    task.saved[0] = func;
+
+                    // If function not found, i.e. not yet declared, defined
+                    // then codegen its proto, which is removed again if the checks below fail
+                    if (!func) task.func = func = generatePrototype(proto);
+
+                    // Check for existing definition
+                    if (!func->empty() || Signatures()[proto.name].defined) {
+                        throw Utility::getError(Utility::CE, "Function '{}' cannot be redefined",
+                                                Utility::getSymbolName(proto.name));
+                    }
+
+                    // Check that the definition matches the declaration
+                    if (func->arg_size() != proto.argCount) {
+                        throw Utility::getError(Utility::CE, "Function '{}' requires {} arguments, given {}",
+                                                Utility::getSymbolName(proto.name), func->arg_size(),
+                                                proto.argCount);
+                    }
+
+                    // Values of impure functions can't be reused
+                    if (function.memoize && !isPureFunction(codegen, program, task.id)) {
+                        throw Utility::getError(Utility::CE, "Function '{}' cannot be memoized, as it calls "
+                                                             "functions that are not pure",
+                                                Utility::getSymbolName(proto.name));
+                    }
+                    task.func = func;
+
+                    // Create a basic block for function, i.e. function body
+                    // SetInsertPoint to specify that instructions shall be appended to block
+                    auto block = llvm::BasicBlock::Create(Context(), "entry", func);
+                    Builder().SetInsertPoint(block);
+
+                    // Floating-point operations of the body get the flags of the options and of the annotations
+                    setFastMathFlags(*func, Builder(), codegen.fastMath | function.fastMath);
+
+                    // Branches are counted as they are generated, after the calls of the function
+                    counterCount = 1;
+                    branches.clear();
+                    if (!codegen.profile.generate.empty()) {
+                        counters = new llvm::GlobalVariable(Module(), Builder().getInt64Ty(), false,
+                                                            llvm::GlobalValue::ExternalLinkage, nullptr);
+                    }
+
+                    // Record function arguments
+                    // Arguments are recorded by the symbols of the prototype that declared the function
+                    NamedValues().clear();
+                    auto args = program.getArgs(proto);
+                    unsigned idx = 0;
+                    for (auto &arg: func->args()) {
+                        NamedValues()[args[idx++]] = &arg;
+                    }
+
+                    // Implement function body
+                    return schedule(function.body, true);
+                }
+
+                // Create return value
+                Builder().CreateRet(pop());
+
+                // Pure functions are memoized on request, or by default if they recurse more than once, as
+                // they are likely to be called with the same arguments again
+                auto pure = isPureFunction(codegen, program, task.id);
+                if (function.memoize || (codegen.memo.automatic && pure && countRecursiveCalls(program, task.id) > 1)) {
+                    memoize(*task.func, codegen.memo);
+                }
+                if (counters) {
+                    instrument(*task.func, counters, counterCount);
+                    counters = nullptr;
+                }
+                if (codegen.profile.use) applyProfile(*task.func, *codegen.profile.use, counterCount, branches);
+
+                // Verify function well-formed-ness
+                // Optimisation happens once the module is complete
+                llvm::verifyFunction(*task.func);
+
+                auto &signature = Signatures()[program.get<Prototype>(function.proto).name];
+                signature.defined = true;
+                signature.pure = pure;
+                finish(task.func);
+            }
+
+            void operator()(const IfExpr &expr) {
+                auto &task = tasks.back();
+                auto &[then_block, else_block, cont_block] = task.blocks;
+                switch (task.stage++) {
+                    case 0:
+                        // codegen condition_clause
+                        return schedule(expr.condition_clause);
+
+                    case 1: {
+                        // Convert cond_code to bool by comparing with zero
+                        auto cond_code = Builder().CreateFCmpONE(pop(), Number(0), "if_cond");
+
+                        auto func = Builder().GetInsertBlock()->getParent();
+
+                        // Generate blocks for then, else, if_cont (merging then and else)
+                        then_block = llvm::BasicBlock::Create(Context(), "then", func);
+                        else_block = llvm::BasicBlock::Create(Context(), "else");
+                        cont_block = llvm::BasicBlock::Create(Context(), "if_cont");
+
+                        // Create conditional branch
+                        auto branch = Builder().CreateCondBr(cond_code, then_block, else_block);
+                        task.counter = addCounters();
+                        if (codegen.profile.use) branches.push_back({branch, task.counter, false});
+
+                        // codegen then_code to insert to then_block
+                        Builder().SetInsertPoint(then_block);
+                        count(task.counter);
+                        return schedule(expr.then_clause, task.tail);
+                    }
+
+                    case 2: {
+                        task.saved[0] = pop();
+
+                        // Make cont_block a branch from then_block
+                        // This is necessary because later, else_block will also branch to cont_block
+                        // NOTE: LLVM strictly require all branch to terminate explicitly
+                        Builder().CreateBr(cont_block);
+
+                        // codegen of then_clause could change block
+                        // Hence, we need to retrieve it
+                        then_block = Builder().GetInsertBlock();
+
+                        // codegen else_code to insert to else_code
+                        // But first add else_block to func
+                        auto func = then_block->getParent();
+                        func->getBasicBlockList().push_back(else_block);
+                        Builder().SetInsertPoint(else_block);
+                        count(task.counter + 1);
+                        return schedule(expr.else_clause, task.tail);
+                    }
+
+                    default:
+                        break;
+                }
+
+                auto then_code = task.saved[0];
+                auto else_code = pop();
+
+                // Branch to cont_block (similar to above)
+                Builder().CreateBr(cont_block);
+
+                // codegen of else_clause could change block
+                // Hence, we need to retrieve it
+                else_block = Builder().GetInsertBlock();
+
+                // Now insert cont_block into function
+                else_block->getParent()->getBasicBlockList().push_back(cont_block);
+                Builder().SetInsertPoint(cont_block);
+
+                // Make PHI node
+                auto phi = Builder().CreatePHI(DoubleType(), 2, "if_tmp");
+                phi->addIncoming(then_code, then_block);
+                phi->addIncoming(else_code, else_block);
+                finish(phi);
+            }
+
+            void operator()(const ForExpr &expr) {
+                auto &task = tasks.back();
+                auto &[existing_value, next_variable] = task.saved;
+                switch (task.stage++) {
+                    case 0:
+                        // codegen start value
+                        return schedule(expr.start);
+
+                    case 1: {
+                        auto start_code = pop();
+
+                        // Get pre-loop block
+                        auto pre_entry_block = Builder().GetInsertBlock();
+
+                        // Get parent function
+                        auto func = pre_entry_block->getParent();
+
+                        // Create loop block
+                        task.blocks[0] = llvm::BasicBlock::Create(Context(), "loop", func);
+
+                        // Create fall through pre-entry block to loop block
+                        Builder().CreateBr(task.blocks[0]);
+
+                        // Set insert point to loop block to put instructions there
+                        Builder().SetInsertPoint(task.blocks[0]);
+
+                        // Create PHI node
+                        // As loop block can come from pre-entry block as well as itself
+                        task.variable = Builder().CreatePHI(DoubleType(), 2, Utility::getSymbolName(expr.varName));
+                        task.variable->addIncoming(start_code, pre_entry_block);
+
+                        // Add loop variable to symbol table
+                        // Save the existing if any
+                        existing_value = NamedValues()[expr.varName];
+                        NamedValues()[expr.varName] = task.variable;
+
+                        // Iterations are counted in the loop block, and exits after it
+                        task.counter = addCounters();
+                        count(task.counter);
+
+                        // codegen body expression
+                        // Its value is not needed, and insert point already points to loop block
+                        return schedule(expr.body);
+                    }
+
+                    case 2:
+                        pop();
+
+                        // codegen step value
+                        // If there isn't one (since it's optional), set it to default value of 1
+                        if (expr.step) return schedule(expr.step);
+                        values.push_back(Number(1.0));
+                        return;
+
+                    case 3:
+                        next_variable = Builder().CreateFAdd(task.variable, pop(), "next_" + task.variable->getName());
+
+                        // codegen end condition
+                        return schedule(expr.end);
+
+                    default:
+                        break;
+                }
+
+                // convert end condition to bool by comparing non-equal to 0.0
+                auto end_code = Builder().CreateFCmpONE(pop(), Number(0.0), "loop_cond");
+
+                // create after loop block
+                auto loop_end_block = Builder().GetInsertBlock();
+                auto after_loop_block = llvm::BasicBlock::Create(Context(), "after_loop", loop_end_block->getParent());
+
+                // create conditional branch based on end code
+                // If true, go back to loop block, otherwise, go to after loop block
+                auto branch = Builder().CreateCondBr(end_code, task.blocks[0], after_loop_block);
+                if (codegen.profile.use) branches.push_back({branch, task.counter, true});
+
+                // Set insert point to after block so any new code will go there
+                Builder().SetInsertPoint(after_loop_block);
+                count(task.counter + 1);
+
+                // Add next variable as the second entry of PHI node
+                task.variable->addIncoming(next_variable, loop_end_block);
+
+                // Restore existing variable saved earlier
+                if (existing_value) NamedValues()[expr.varName] = existing_value;
+                else NamedValues().erase(expr.varName);
+
+                // Set return value for for-loop
+                // For now, it is set to default of 0.0
+                finish(Number(0.0));
+            }
+        };
+    }
+
+    bool isPureFunction(const CodeGenerator &codegen, const Program &program, ExprId function) {
+        const auto &func = program.get<Function>(function);
+        auto name = program.get<Prototype>(func.proto).name;
+        std::vector<ExprId> pending{func.body};
+        while (!pending.empty()) {
+            auto id = pending.back();
+            pending.pop_back();
+            if (id.kind() == ExprKind::Call) {
+                auto callee = program.get<CallExpr>(id).callee;
+                auto signature = codegen.signatures.find(callee);
+                if (callee != name && (signature == codegen.signatures.end() || !signature->second.pure)) {
+                    return false;
+                }
+            }
+            for (std::uint32_t i = 0; i < countChildren(program, id); ++i) {
+                if (auto child = getChild(program, id, i)) pending.push_back(child);
+            }
+        }
+        return true;
+    }
+
+    llvm::Value *generateIR(CodeGenerator &codegen, const Program &program, ExprId id) {
+        return IRGenerator{codegen, program}.generate(id);
     }
 }
@@ -14,4 +14,6 @@ namespace Firestorm::Utility {
     ParserError::ParserError(const std::string &msg) : FirestormError(msg), std::runtime_error(msg) {}
 
     CodegenError::CodegenError(const std::string &msg) : FirestormError(msg), std::runtime_error(msg) {}
+
+    BackendError::BackendError(const std::string &msg) : FirestormError(msg), std::runtime_error(msg) {}
 }
@@ -0,0 +1,301 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/evaluator.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace Firestorm::AST {
+    namespace {
+        /// @brief Conditions are true if they are neither 0 nor NaN, like 'fcmp one' in LLVM IR
+        bool isTrue(double value) {
+            return value < 0 || value > 0;
+        }
+
+        /// @brief Interpreter of the bodies of pure functions, with the same semantics as their IR.
+        ///
+        /// @note Like IRGenerator, nodes are evaluated without recursion, and neither are calls: every task runs in
+        /// stages, each scheduling at most one child, whose value it finds on top of values.
+        struct Evaluation {
+            struct Task {
+                ExprId id;
+                std::uint32_t stage = 0;
+
+                /// @brief Index of the variable of a for-loop in variables
+                std::uint32_t slot = 0;
+
+                /// @brief Next value of the variable of a for-loop
+                double next = 0;
+            };
+
+            const Program &library;
+            const std::unordered_map<Utility::Symbol, ExprId> &functions;
+            std::uint64_t fuel;
+            std::uint32_t depth;
+
+            std::vector<Task> tasks;
+            std::vector<double> values;
+
+            /// @brief Variables of all frames, the innermost last
+            std::vector<std::pair<Utility::Symbol, double>> variables;
+
+            /// @brief Index in variables of the first argument of every frame
+            std::vector<std::size_t> frames;
+
+            /// @brief Binds the arguments on top of values, and schedules the body of function.
+            ///
+            /// @return Whether the call is within the depth limit
+            bool enter(const Function &function) {
+                if (frames.size() >= depth) return false;
+                const auto &proto = library.get<Prototype>(function.proto);
+                auto args = values.end() - proto.argCount;
+
+                frames.push_back(variables.size());
+                for (auto param: library.getArgs(proto)) variables.emplace_back(param, *args++);
+                values.resize(values.size() - proto.argCount);
+                tasks.push_back({function.body});
+                return true;
+            }
+
+            std::optional<double> lookupVariable(Utility::Symbol name) const {
+                // Variables of loops shadow those before them, and variables of callers are not visible
+                for (auto i = variables.size(); i > frames.back(); --i) {
+                    if (variables[i - 1].first == name) return variables[i - 1].second;
+                }
+                return std::nullopt;
+            }
+
+            double pop() {
+                auto value = values.back();
+                values.pop_back();
+                return value;
+            }
+
+            /// @return The value of the body scheduled by enter(), or nothing if it runs out of fuel or depth
+            std::optional<double> run() {
+                while (!tasks.empty()) {
+                    if (fuel-- == 0) return std::nullopt;
+                    if (!step()) return std::nullopt;
+                }
+                return values.back();
+            }
+
+            /// @brief Runs a stage of the current task.
+            ///
+            /// @return Whether it could be evaluated
+            bool step() {
+                auto &task = tasks.back();
+                auto id = task.id;
+                switch (id.kind()) {
+                    case ExprKind::Number:
+                        values.push_back(library.get<NumberExpr>(id).value);
+                        tasks.pop_back();
+                        return true;
+
+                    case ExprKind::Variable: {
+                        auto value = lookupVariable(library.get<VariableExpr>(id).name);
+                        if (!value) return false;
+                        values.push_back(*value);
+                        tasks.pop_back();
+                        return true;
+                    }
+
+                    case ExprKind::Binary: {
+                        const auto &expr = library.get<BinaryExpr>(id);
+                        if (task.stage < 2) {
+                            auto child = task.stage++ == 0 ? expr.lhs : expr.rhs;
+                            tasks.push_back({child});
+                            return true;
+                        }
+                        tasks.pop_back();
+
+                        // The same operations as the IR of BinaryExpr
+                        auto rhs = pop();
+                        auto lhs = pop();
+                        switch (expr.op) {
+                            case Operator::Add:
+                                values.push_back(lhs + rhs);
+                                return true;
+                            case Operator::Sub:
+                                values.push_back(lhs - rhs);
+                                return true;
+                            case Operator::Mul:
+                                values.push_back(lhs * rhs);
+                                return true;
+                            case Operator::Div:
+                                values.push_back(lhs / rhs);
+                                return true;
+                            case Operator::Equ:
+                                values.push_back(lhs == rhs);
+                                return true;
+                            case Operator::Lt:
+                                // Unordered, like 'fcmp ult'
+                                values.push_back(!(lhs >= rhs));
+                                return true;
+                            default:
+                                return false;
+                        }
+                    }
+
+                    case ExprKind::Call: {
+                        const auto &expr = library.get<CallExpr>(id);
+                        if (task.stage < expr.argCount) {
+                            auto arg = library.getArgs(expr)[task.stage++];
+                            tasks.push_back({arg});
+                            return true;
+                        }
+                        if (task.stage++ == expr.argCount) {
+                            // Calls of pure functions only refer to pure functions, which are never forgotten
+                            auto callee = functions.find(expr.callee);
+                            if (callee == functions.end() || !callee->second) return false;
+                            return enter(library.get<Function>(callee->second));
+                        }
+
+                        // The value of the body is the value of the call
+                        variables.resize(frames.back());
+                        frames.pop_back();
+                        tasks.pop_back();
+                        return true;
+                    }
+
+                    case ExprKind::If: {
+                        const auto &expr = library.get<IfExpr>(id);
+                        switch (task.stage++) {
+                            case 0:
+                                tasks.push_back({expr.condition_clause});
+                                return true;
+                            case 1:
+                                tasks.push_back({isTrue(pop()) ? expr.then_clause : expr.else_clause});
+                                return true;
+                            default:
+                                tasks.pop_back();
+                                return true;
+                        }
+                    }
+
+                    case ExprKind::For: {
+                        const auto &expr = library.get<ForExpr>(id);
+                        switch (task.stage++) {
+                            case 0:
+                                tasks.push_back({expr.start});
+                                return true;
+
+                            case 1:
+                                task.slot = (std::uint32_t) variables.size();
+                                variables.emplace_back(expr.varName, pop());
+                                tasks.push_back({expr.body});
+                                return true;
+
+                            case 2:
+                                // The value of the body is not needed
+                                // If there isn't a step (since it's optional), it is 1
+                                values.pop_back();
+                                if (expr.step) tasks.push_back({expr.step});
+                                else values.push_back(1.0);
+                                return true;
+
+                            case 3:
+                                // The end condition still sees the current value
+                                task.next = variables[task.slot].second + pop();
+                                tasks.push_back({expr.end});
+                                return true;
+
+                            default:
+                                break;
+                        }
+
+                        variables[task.slot].second = task.next;
+                        if (isTrue(pop())) {
+                            task.stage = 2;
+                            tasks.push_back({expr.body});
+                            return true;
+                        }
+
+                        // The value of a for-loop is 0
+                        variables.pop_back();
+                        values.push_back(0.0);
+                        tasks.pop_back();
+                        return true;
+                    }
+
+                    default:
+                        return false;
+                }
+            }
+        };
+    }
+
+    bool PartialEvaluator::isPure(const Program &program, const Function &function) const {
+        const auto &proto = program.get<Prototype>(function.proto);
+        auto params = program.getArgs(proto);
+        std::vector<Utility::Symbol> scope(params.begin(), params.end());
+
+        // Children are checked one per stage, and the variable of a for-loop is in scope from its end condition
+        std::vector<std::pair<ExprId, std::uint32_t>> tasks{{function.body, 0}};
+        while (!tasks.empty()) {
+            auto [id, stage] = tasks.back();
+            if (stage == 0) {
+                if (id.kind() == ExprKind::Variable) {
+                    auto name = program.get<VariableExpr>(id).name;
+                    if (std::find(scope.begin(), scope.end(), name) == scope.end()) return false;
+                } else if (id.kind() == ExprKind::Call) {
+                    const auto &call = program.get<CallExpr>(id);
+                    std::uint32_t arity;
+                    if (call.callee == proto.name) {
+                        arity = proto.argCount;
+                    } else {
+                        auto it = functions.find(call.callee);
+                        if (it == functions.end() || !it->second) return false;
+                        arity = library.get<Prototype>(library.get<Function>(it->second).proto).argCount;
+                    }
+                    if (arity != call.argCount) return false;
+                }
+            }
+
+            if (stage == countChildren(program, id)) {
+                if (id.kind() == ExprKind::For) scope.pop_back();
+                tasks.pop_back();
+                continue;
+            }
+            if (id.kind() == ExprKind::For && stage == 1) scope.push_back(program.get<ForExpr>(id).varName);
+            ++tasks.back().second;
+            if (auto child = getChild(program, id, stage)) tasks.emplace_back(child, 0);
+        }
+        return true;
+    }
+
+    void PartialEvaluator::declare(const Program &program, ExprId stmt) {
+        auto proto = stmt.kind() == ExprKind::Function ? program.get<Function>(stmt).proto : stmt;
+        auto name = program.get<Prototype>(proto).name;
+        // Only the first declaration of a name compiles, and pure functions defined before may call it, so later
+        // ones, including externs of a function defined already, leave it as it is
+        auto [it, inserted] = functions.emplace(name, ExprId());
+        if (!inserted) return;
+        if (stmt.kind() == ExprKind::Function && isPure(program, program.get<Function>(stmt))) {
+            it->second = copyTree(library, program, stmt);
+        }
+    }
+
+    std::optional<double> PartialEvaluator::evaluate(const Program &program, const CallExpr &call) const {
+        auto it = functions.find(call.callee);
+        if (it == functions.end() || !it->second || limits.fuel == 0) return std::nullopt;
+        const auto &function = library.get<Function>(it->second);
+        if (library.get<Prototype>(function.proto).argCount != call.argCount) return std::nullopt;
+
+        Evaluation evaluation{library, functions, limits.fuel, limits.depth};
+        for (auto arg: program.getArgs(call)) {
+            if (arg.kind() != ExprKind::Number) return std::nullopt;
+            evaluation.values.push_back(program.get<NumberExpr>(arg).value);
+        }
+        if (!evaluation.enter(function)) return std::nullopt;
+        return evaluation.run();
+    }
+
+    ExprId PartialEvaluator::fold(Program &program, ExprId id) const {
+        if (id.kind() != ExprKind::Call) return id;
+        auto value = evaluate(program, program.get<CallExpr>(id));
+        return value ? program.add(NumberExpr{*value}) : id;
+    }
+}
@@ -1,51 +1,549 @@
 //
 // Created by Nguyen Thai Binh on 18/1/22.
 //
+#include "Firestorm/aot.hpp"
 #include "Firestorm/ast.hpp"
+#include "Firestorm/ast_optimiser.hpp"
+#include "Firestorm/cache.hpp"
+#include "Firestorm/codegen.hpp"
 #include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/jit.hpp"
 #include "Firestorm/lexer.hpp"
+#include "Firestorm/parallel.hpp"
 #include "Firestorm/parser.hpp"
 #include "Firestorm/frontend.hpp"
+#include "Firestorm/runtime.hpp"
+#include "Firestorm/source.hpp"
+#include "Firestorm/vm.hpp"
 
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 
 namespace Firestorm::Frontend {
-    void Interpreter::run() {
-        // Initialisation
-        Firestorm::Lexing::Lexer lexer;
-        Firestorm::Lexing::Token previousToken;        // Continue the previous stream
+    namespace {
+        /// @brief Parses a file one statement at a time, streaming it from disk, so that neither the whole AST
+        /// nor the whole source has to stay in memory.
+        ///
+        /// @param compile Called with the program and each statement of options.input in it, once the AST
+        /// optimiser has run on it. The nodes of the statement are removed from program once it returns.
+        template<class Compile>
+        void forEachStatement(const Options &options, Compile &&compile) {
+            auto source = Firestorm::Lexing::Source::fromFile(options.input);
+            Firestorm::Lexing::Lexer lexer;
+            auto stream = lexer.lex(source);
+            Firestorm::Parsing::Parser parser(stream);
+            Firestorm::AST::Program program;
+            AST::ASTOptimiser optimiser(options.optimiser.level, options.evaluation);
+
+            while (auto stmt = parser.parseNext(program)) {
+                compile(program, optimiser.run(program, stmt));
+
+                // The statement is no longer needed, so its memory is reused for the next one
+                program.clear();
+
+                // Everything before the current token has been consumed
+                source.release(stream.currentToken.index);
+            }
+        }
+
+        /// @brief Name of the functions that top-level expressions are wrapped in
+        Utility::Symbol getAnonymousName() {
+            static const auto anonymous = Utility::internSymbol("__anon_expr");
+            return anonymous;
+        }
+
+        /// @brief Emits a top-level expression as a function without arguments, for compiled code.
+        ///
+        /// @return The function, which LLVM names apart from those of other expressions
+        llvm::Function *generateExpression(AST::CodeGenerator &codegen, AST::Program &program, AST::ExprId stmt,
+                                           llvm::Function::LinkageTypes linkage) {
+            auto proto = program.add(AST::Prototype{getAnonymousName(), 0, 0});
+            auto func = (llvm::Function *) AST::generateIR(codegen, program, program.add(AST::Function{proto, stmt}));
+            func->setLinkage(linkage);
+
+            // The name is free again, and LLVM renames the next function that takes it
+            codegen.functions.erase(getAnonymousName());
+            codegen.signatures.erase(getAnonymousName());
+            return func;
+        }
+
+        /// @brief Writes the object file of options.input, then links it into an executable unless
+        /// options.objectOnly.
+        ///
+        /// @param emit Called with the path to write the object file to
+        template<class Emit>
+        void writeOutput(const Options &options, Emit &&emit) {
+            if (options.objectOnly) {
+                auto output = options.output;
+                if (output.empty()) output = (llvm::sys::path::stem(options.input) + ".o").str();
+                emit(output);
+                return;
+            }
+
+            // Otherwise, the object file is only needed until it is linked
+            llvm::SmallString<128> object;
+            if (auto error = llvm::sys::fs::createTemporaryFile("firestorm", "o", object)) {
+                throw Utility::getError(Utility::BE, "Cannot create a temporary file: {}", error.message());
+            }
+            llvm::FileRemover remover(object);
+            emit(std::string(object));
+            Backend::linkExecutable(std::string(object), options.output.empty() ? "a.out" : options.output);
+        }
+
+        /// @brief Writes data to the file at path, replacing it.
+        void writeFile(const std::string &path, llvm::StringRef data) {
+            std::error_code error;
+            llvm::raw_fd_ostream file(path, error, llvm::sys::fs::OF_None);
+            if (error) throw Utility::getError(Utility::BE, "Cannot open '{}': {}", path, error.message());
+            file << data;
+        }
+
+        /// @return A generator of the functions of options.input on options.jobs threads, or nullptr if they are
+        /// generated by codegen itself
+        std::unique_ptr<AST::ParallelCodeGenerator> createParallelCodeGenerator(AST::CodeGenerator &codegen,
+                                                                                const AST::OptimiserOptions &optimiser,
+                                                                                const Options &options) {
+            // Lazy functions are generated when they are called
+            if (options.jobs == 1 || options.lazy) return nullptr;
+            return std::make_unique<AST::ParallelCodeGenerator>(codegen, optimiser, options.jobs);
+        }
+
+        /// @return Passes to run on code before it first runs in the JIT, which are minimal with tiering
+        AST::OptimiserOptions getJITOptimiserOptions(const Options &options) {
+            if (!options.tiered) return options.optimiser;
+            AST::OptimiserOptions optimiser{AST::OptimisationLevel::O0};
+            optimiser.fastMath = options.optimiser.fastMath;
+            optimiser.memo = options.optimiser.memo;
+            optimiser.profile = options.optimiser.profile;
+            return optimiser;
+        }
+
+        /// @return How the JIT recompiles hot functions, i.e. at -O3 with the extra passes of options
+        std::optional<Backend::TieringOptions> getTieringOptions(const Options &options) {
+            if (!options.tiered) return std::nullopt;
+            auto optimiser = options.optimiser;
+            optimiser.level = AST::OptimisationLevel::O3;
+            return Backend::TieringOptions{optimiser};
+        }
+
+        /// @return The cache of options.cacheDirectory for the code of the JIT, or nullptr if there is none or
+        /// functions are tiered
+        std::unique_ptr<Backend::CompileCache> createJITCache(const Options &options) {
+            if (options.cacheDirectory.empty() || options.tiered) return nullptr;
+            return std::make_unique<Backend::CompileCache>(options.cacheDirectory, getJITOptimiserOptions(options));
+        }
+
+        /// @brief Writes the counters of the functions that ran in the JIT, if they are instrumented.
+        void writeProfile(const Options &options) {
+            const auto &path = options.optimiser.profile.generate;
+            if (!path.empty()) firestorm_write_profile(path.c_str());
+        }
+
+        /// @brief Declares a definition whose code is compiled apart from codegen, reporting the errors of the
+        /// definition itself, but not those of its body.
+        void declareDefinition(AST::CodeGenerator &codegen, const AST::Program &program, AST::ExprId stmt) {
+            const auto &definition = program.get<AST::Function>(stmt);
+            const auto &proto = program.get<AST::Prototype>(definition.proto);
+            auto name = proto.name;
+
+            auto args = program.getArgs(proto);
+            auto declared = codegen.signatures.find(name);
+            if (declared != codegen.signatures.end()) {
+                if (declared->second.defined) {
+                    throw Utility::getError(Utility::CE, "Function '{}' cannot be redefined",
+                                            Utility::getSymbolName(name));
+                }
+                if (declared->second.parameters.size() != args.size()) {
+                    throw Utility::getError(Utility::CE, "Function '{}' requires {} arguments, given {}",
+                                            Utility::getSymbolName(name), declared->second.parameters.size(),
+                                            args.size());
+                }
+            }
+            auto pure = AST::isPureFunction(codegen, program, stmt);
+            if (definition.memoize && !pure) {
+                throw Utility::getError(Utility::CE, "Function '{}' cannot be memoized, as it calls functions that "
+                                                     "are not pure", Utility::getSymbolName(name));
+            }
+
+            // Later statements can call the function, and evaluate it if it is pure
+            auto &signature = codegen.signatures[name];
+            signature.parameters.assign(args.begin(), args.end());
+            signature.pure = pure;
+            signature.defined = true;
+        }
+
+        /// @brief Hands over the module of the definition of name that codegen just generated, marked to be cached
+        /// as key once it is compiled, and caches its body for later modules to inline.
+        llvm::orc::ThreadSafeModule takeDefinition(AST::CodeGenerator &codegen, Utility::Symbol name,
+                                                   const Backend::CompileCache *cache, const std::string &key) {
+            auto module = codegen.takeModule();
+            if (!cache) return module;
+            module.withModuleDo([&](llvm::Module &m) { Backend::CompileCache::setKey(m, key); });
+            auto body = codegen.inlineableBodies.find(name);
+            if (body != codegen.inlineableBodies.end()) {
+                cache->store(key, "body.bc", llvm::StringRef(body->second.data(), body->second.size()));
+            }
+            return module;
+        }
+
+        /// @brief Caches the optimised IR of a definition as key, so that later runs neither generate nor optimise
+        /// it again, even if none of them calls it, and its code is never cached.
+        ///
+        /// @note The body of an inlineable function is its whole module, so it is not stored twice.
+        void storeModule(const AST::CodeGenerator &codegen, const Backend::CompileCache &cache, Utility::Symbol name,
+                         const std::string &key, const llvm::orc::ThreadSafeModule &module) {
+            if (codegen.inlineableBodies.count(name)) return;
+            llvm::SmallVector<char, 0> bitcode;
+            llvm::raw_svector_ostream out(bitcode);
+            module.withModuleDo([&](llvm::Module &m) { llvm::WriteBitcodeToFile(m, out); });
+            cache.store(key, "module.bc", llvm::StringRef(bitcode.data(), bitcode.size()));
+        }
+
+        /// @brief Declares a definition, and adds its code from the cache, or else its optimised IR, together with
+        /// its body for later modules to inline.
+        ///
+        /// @return Whether the cache has its code or its IR
+        bool loadDefinition(AST::CodeGenerator &codegen, Backend::JIT &jit, const Backend::CompileCache &cache,
+                            const AST::Program &program, AST::ExprId stmt, const std::string &key) {
+            llvm::orc::ThreadSafeModule module;
+            auto object = cache.load(key, "o");
+            auto body = cache.load(key, "body.bc");
+            if (!object) {
+                auto bitcode = body ? llvm::MemoryBuffer::getMemBuffer(body->getMemBufferRef(), false)
+                                    : cache.load(key, "module.bc");
+                if (!bitcode) return false;
+                auto context = std::make_unique<llvm::LLVMContext>();
+                auto parsed = llvm::parseBitcodeFile(*bitcode, *context);
+                if (!parsed) {
+                    // Generated again, which replaces the entry
+                    llvm::consumeError(parsed.takeError());
+                    return false;
+                }
+                Backend::CompileCache::setKey(**parsed, key);
+                module = llvm::orc::ThreadSafeModule(std::move(*parsed), std::move(context));
+            }
+            declareDefinition(codegen, program, stmt);
+
+            auto name = program.get<AST::Prototype>(program.get<AST::Function>(stmt).proto).name;
+            if (body) {
+                codegen.inlineableBodies[name].assign(body->getBufferStart(), body->getBufferEnd());
+            }
+
+            // Either is only compiled and linked when the function is first called
+            if (object) jit.addObject(std::move(object));
+            else jit.addFunction(std::move(module));
+            return true;
+        }
+
+        /// @brief Declares a definition, and keeps a copy of its AST to generate and compile it from on its first
+        /// call.
+        ///
+        /// @param cache Cache to store the code of the definition in as key, or nullptr
+        void defineLazily(AST::CodeGenerator &codegen, Backend::JIT &jit, const AST::Program &program,
+                          AST::ExprId stmt, const Backend::CompileCache *cache, const std::string &key) {
+            // Errors of the definition itself are reported now, and those of its body on its first call
+            declareDefinition(codegen, program, stmt);
+
+            auto name = program.get<AST::Prototype>(program.get<AST::Function>(stmt).proto).name;
+            auto copy = std::make_shared<AST::Program>();
+            auto function = AST::copyTree(*copy, program, stmt);
+            auto generate = [&codegen, copy, function, name, cache, key] {
+                // The function is only declared so far, and the definition keeps the declaration if it fails
+                codegen.signatures[name].defined = false;
+                AST::generateIR(codegen, *copy, function);
+                return takeDefinition(codegen, name, cache, key);
+            };
+            jit.addLazyFunction(std::string(Utility::getSymbolName(name)), std::move(generate));
+        }
+
+        /// @brief Compiles a statement to native code and runs it.
+        ///
+        /// @note Every definition is compiled in its own module, and stays callable by later statements.
+        /// Top-level expressions are wrapped in an anonymous function, whose code is removed once it has run.
+        ///
+        /// @param lazy Whether definitions are only compiled on their first call
+        ///
+        /// @param cache Cache that code is loaded from instead of being generated and compiled, and stored in
+        /// otherwise, or nullptr
+        ///
+        /// @return The value of a top-level expression, or nothing for externs and definitions
+        std::optional<double> execute(AST::CodeGenerator &codegen, Backend::JIT &jit, AST::Program &program,
+                                      AST::ExprId stmt, bool lazy, Backend::CompileCache *cache) {
+            // Every statement has a key, as those of externs and definitions are part of the keys of their callers
+            std::string key;
+            if (cache) key = cache->getKey(program, stmt);
+
+            switch (stmt.kind()) {
+                case AST::ExprKind::Prototype:
+                    // Externs are declared for all later modules
+                    AST::generateIR(codegen, program, stmt);
+                    return std::nullopt;
+
+                case AST::ExprKind::Function: {
+                    // Cached code is compiled or linked when it is first called, so it is not loaded lazily again
+                    if (cache && loadDefinition(codegen, jit, *cache, program, stmt, key)) return std::nullopt;
+                    if (lazy) {
+                        defineLazily(codegen, jit, program, stmt, cache, key);
+                        return std::nullopt;
+                    }
+                    AST::generateIR(codegen, program, stmt);
+                    auto name = program.get<AST::Prototype>(program.get<AST::Function>(stmt).proto).name;
+                    auto module = takeDefinition(codegen, name, cache, key);
+                    if (cache) storeModule(codegen, *cache, name, key, module);
+                    jit.addFunction(std::move(module));
+                    return std::nullopt;
+                }
+
+                default: {
+                    auto anonymous = getAnonymousName();
+                    auto object = cache ? cache->load(key, "o") : nullptr;
+                    llvm::orc::ThreadSafeModule module;
+                    if (!object) {
+                        auto proto = program.add(AST::Prototype{anonymous, 0, 0});
+
+                        // The code of expressions is removed once it has run, so it can't keep counters, and its
+                        // name is shared by all of them, so it has no profile of its own
+                        auto profile = std::exchange(codegen.profile, {});
+                        try {
+                            AST::generateIR(codegen, program, program.add(AST::Function{proto, stmt}));
+                        } catch (...) {
+                            codegen.profile = std::move(profile);
+                            throw;
+                        }
+                        codegen.profile = std::move(profile);
+
+                        // The name is free again once the function has run
+                        module = codegen.takeModule();
+                        codegen.signatures.erase(anonymous);
+                        codegen.inlineableBodies.erase(anonymous);
+                        if (cache) module.withModuleDo([&](llvm::Module &m) { Backend::CompileCache::setKey(m, key); });
+                    }
+
+                    // Native code writes to stdout directly, so buffered output must come first
+                    llvm::outs().flush();
+                    auto name = std::string(Utility::getSymbolName(anonymous));
+                    auto value = object ? jit.evaluate(std::move(object), name) : jit.evaluate(std::move(module), name);
+                    std::fflush(stdout);
+                    return value;
+                }
+            }
+        }
+
+        /// @brief Compiles a statement to bytecode and runs it.
+        ///
+        /// @return The value of a top-level expression, or nothing for externs and definitions
+        std::optional<double> execute(Backend::VM &vm, AST::Program &program, AST::ExprId stmt) {
+            auto function = Backend::compileBytecode(vm.module, program, stmt);
+            if (!function) return std::nullopt;
+
+            // Externs write to stdout directly, so buffered output must come first
+            llvm::outs().flush();
+            auto value = vm.run(*function);
+            std::fflush(stdout);
+            return value;
+        }
+
+        /// @brief Runs the REPL, until the end of the input or '=exit'.
+        ///
+        /// @param execute Called with the program and every statement in it, once the AST optimiser has run on it,
+        /// returning the value of expressions
+        template<class Execute>
+        void runREPL(const Options &options, Execute &&execute) {
+            Firestorm::Lexing::Lexer lexer;
+            AST::ASTOptimiser optimiser(options.optimiser.level, options.evaluation);
+            std::string input;
+
+            while (true) {
+                llvm::outs() << "Input> ";
+                llvm::outs().flush();
+
+                if (!std::getline(std::cin, input) || input == "=exit") break;
+                try {
+                    // Tokenize input
+                    // Tokens are views into input, so they are not carried over to the next line
+                    auto stream = lexer.lex(input);
+
+                    // Parse token stream
+                    auto program = Firestorm::Parsing::Parser(stream).parse();
+
+                    // Run every statement, printing the values of expressions
+                    for (auto stmt: program.statements) {
+                        if (auto value = execute(program, optimiser.run(program, stmt))) {
+                            llvm::outs() << fmt::format("{}\n", *value);
+                        }
+                    }
+                } catch (const Firestorm::Utility::FirestormError &error) {
+                    llvm::outs() << "Error: " << error.what() << "\n";
+                }
+            }
+        }
+    }
+
+    void Interpreter::run(const Options &options) {
+        // Nothing of LLVM is set up for the VM
+        if (options.vm) {
+            Backend::VM vm;
+            return runREPL(options, [&](AST::Program &program, AST::ExprId stmt) {
+                return execute(vm, program, stmt);
+            });
+        }
 
-        std::string input;
+        auto cache = createJITCache(options);
+        Firestorm::Backend::JIT jit(getTieringOptions(options), cache.get());
+        AST::CodeGenerator codegen(getJITOptimiserOptions(options));
+        runREPL(options, [&](AST::Program &program, AST::ExprId stmt) {
+            return execute(codegen, jit, program, stmt, options.lazy, cache.get());
+        });
+        if (options.optimiser.memo.stats) firestorm_print_memo_stats();
+        writeProfile(options);
+    }
 
-        while (true) {
-            llvm::outs() << "Input> ";
+    bool Interpreter::runFile(const Options &options) {
+        try {
+            if (options.vm) {
+                Backend::VM vm;
+                forEachStatement(options, [&](AST::Program &program, AST::ExprId stmt) {
+                    execute(vm, program, stmt);
+                });
+                return true;
+            }
 
-            std::getline(std::cin, input);
-            if (input == "=exit") break;
-            try {
-                // Tokenize input
-                auto stream = lexer.lex(input);
+            auto cache = createJITCache(options);
+            Firestorm::Backend::JIT jit(getTieringOptions(options), cache.get());
+            auto optimiser = getJITOptimiserOptions(options);
+            AST::CodeGenerator codegen(optimiser);
 
-                // Load previous token
-                stream.currentToken = previousToken;
+            // Cached functions are not generated at all, so every function is looked up first
+            auto parallel = cache ? nullptr : createParallelCodeGenerator(codegen, optimiser, options);
+            auto addFunctions = [&] {
+                for (auto &module: parallel->finish()) jit.addFunction(std::move(module));
+            };
 
-                // Parse token stream
-                auto program = Firestorm::Parsing::Parser(stream).parse();
+            forEachStatement(options, [&](AST::Program &program, AST::ExprId stmt) {
+                if (parallel) {
+                    if (stmt.kind() == AST::ExprKind::Function) return parallel->define(std::move(program), stmt);
 
-                // Save last token
-                previousToken = stream.currentToken;
+                    // Expressions can call any function defined so far
+                    if (stmt.kind() != AST::ExprKind::Prototype) addFunctions();
+                }
+                execute(codegen, jit, program, stmt, options.lazy, cache.get());
+            });
 
-                // Print IR
-                for (const auto &stmt: program) {
-                    auto IR = stmt->generateIR();
-                    IR->print(llvm::outs());
-                    llvm::outs() << '\n';
+            // Report errors of the functions after the last expression too
+            if (parallel) addFunctions();
+            if (options.optimiser.memo.stats) firestorm_print_memo_stats();
+            writeProfile(options);
+
+            // Lazy functions that failed were reported when called, and their calls returned NaN
+            return !jit.hasFailed();
+        } catch (const Firestorm::Utility::FirestormError &error) {
+            llvm::errs() << "Error: " << error.what() << "\n";
+            return false;
+        }
+    }
+
+    bool Compiler::emitIR(const Options &options) {
+        AST::CodeGenerator codegen(options.optimiser);
+        try {
+            auto parallel = createParallelCodeGenerator(codegen, options.optimiser, options);
+            forEachStatement(options, [&](AST::Program &program, AST::ExprId stmt) {
+                auto kind = stmt.kind();
+                if (parallel && kind == AST::ExprKind::Function) {
+                    return parallel->define(std::move(program), stmt);
+                }
+                if (kind == AST::ExprKind::Prototype || kind == AST::ExprKind::Function) {
+                    AST::generateIR(codegen, program, stmt);
+                } else {
+                    // Kept by the optimiser, so that expressions are printed too
+                    generateExpression(codegen, program, stmt, llvm::Function::ExternalLinkage);
                 }
-            } catch (const Firestorm::Utility::FirestormError &error) {
-                llvm::outs() << "Error: " << error.what() << "\n";
+            });
+
+            // Print the entire module, once the module passes have run too
+            // Functions generated in parallel were optimised in their own modules already
+            codegen.optimiser->run(*codegen.module);
+            if (parallel) AST::linkModules(codegen, parallel->finish());
+        } catch (const Firestorm::Utility::FirestormError &error) {
+            llvm::errs() << "Error: " << error.what() << "\n";
+            return false;
+        }
+
+        codegen.module->print(llvm::outs(), nullptr);
+        return true;
+    }
+
+    bool Compiler::compile(const Options &options) {
+        try {
+            std::unique_ptr<Backend::CompileCache> cache;
+            if (!options.cacheDirectory.empty()) {
+                cache = std::make_unique<Backend::CompileCache>(options.cacheDirectory, options.optimiser);
+            }
+            std::vector<std::string> keys;
+
+            AST::CodeGenerator codegen(options.optimiser);
+            auto parallel = createParallelCodeGenerator(codegen, options.optimiser, options);
+
+            // Top-level expressions become internal functions, called in order by main
+            std::vector<llvm::Function *> statements;
+            forEachStatement(options, [&](AST::Program &program, AST::ExprId stmt) {
+                if (cache) keys.push_back(cache->getKey(program, stmt));
+                auto kind = stmt.kind();
+                if (parallel && kind == AST::ExprKind::Function) {
+                    return parallel->define(std::move(program), stmt);
+                }
+                if (kind == AST::ExprKind::Prototype || kind == AST::ExprKind::Function) {
+                    AST::generateIR(codegen, program, stmt);
+                    return;
+                }
+                statements.push_back(generateExpression(codegen, program, stmt, llvm::Function::InternalLinkage));
+            });
+
+            // The whole program is optimised at once, so it is cached as a whole, and only its generation is
+            // needed to look it up, which leaves out optimising it and emitting its code
+            std::string key;
+            if (cache) {
+                key = cache->getProgramKey(keys, fmt::format("{} {}", options.optimiser.memo.stats,
+                                                             options.optimiser.profile.generate));
+                if (auto object = cache->load(key, "o")) {
+                    writeOutput(options, [&](const std::string &path) { writeFile(path, object->getBuffer()); });
+                    return true;
+                }
+            }
+
+            auto &module = *codegen.module;
+            if (parallel && codegen.signatures.count(Utility::internSymbol("main"))) {
+                // Functions generated in parallel are not in module yet
+                throw Utility::getError(Utility::CE, "Function 'main' is reserved for the entry point of executables");
             }
+            Backend::addEntryPoint(module, statements, options.optimiser.memo.stats,
+                                   options.optimiser.profile.generate);
+            auto machine = Backend::createHostTargetMachine(options.optimiser.level);
+            if (parallel) AST::linkModules(codegen, parallel->finish());
+
+            // Now that the program is complete, its functions are optimised across each other
+            Backend::optimiseModule(module, *machine, options.optimiser, AST::Pipeline::WholeProgram);
+
+            writeOutput(options, [&](const std::string &path) {
+                Backend::emitObjectFile(module, *machine, path);
+                if (!cache) return;
+                if (auto object = llvm::MemoryBuffer::getFile(path)) cache->store(key, "o", (*object)->getBuffer());
+            });
+        } catch (const Firestorm::Utility::FirestormError &error) {
+            llvm::errs() << "Error: " << error.what() << "\n";
+            return false;
         }
-        // Print the entire module
-        Firestorm::AST::getCodegen().module.print(llvm::outs(), nullptr);
+        return true;
     }
 }
@@ -0,0 +1,355 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/jit.hpp"
+#include "Firestorm/runtime.hpp"
+
+#include <limits>
+#include <mutex>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/Layer.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Firestorm::Backend {
+    namespace {
+        /// @brief Converts an llvm::Error to a BackendError, or does nothing if there is no error.
+        void check(llvm::Error error) {
+            if (error) throw Utility::getError(Utility::BE, "{}", llvm::toString(std::move(error)));
+        }
+
+        template<class T>
+        T check(llvm::Expected<T> value) {
+            check(value.takeError());
+            return std::move(*value);
+        }
+
+        /// @return The only function defined in module
+        llvm::Function &getDefinedFunction(llvm::Module &module) {
+            for (auto &func: module) {
+                if (!func.isDeclaration()) return func;
+            }
+            throw Utility::getError(Utility::BE, "Module '{}' defines no function", module.getName().str());
+        }
+
+        /// @brief Called instead of lazy functions that failed to generate or compile, with their arguments.
+        double failLazyCall() {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        /// @brief Materialises a lazy function by generating its module, and compiling it in layer.
+        class LazyFunctionUnit : public llvm::orc::MaterializationUnit {
+            llvm::orc::IRLayer &layer;
+            const llvm::DataLayout &dataLayout;
+            JIT::FunctionGenerator generate;
+
+            void discard(const llvm::orc::JITDylib &, const llvm::orc::SymbolStringPtr &) override {
+                // Functions are never defined twice
+            }
+
+        public:
+            LazyFunctionUnit(llvm::orc::IRLayer &layer, const llvm::DataLayout &dataLayout,
+                             llvm::orc::SymbolStringPtr name, JIT::FunctionGenerator generate)
+#if LLVM_VERSION_MAJOR >= 14
+                    : MaterializationUnit(Interface({{std::move(name), llvm::JITSymbolFlags::Exported |
+                                                                       llvm::JITSymbolFlags::Callable}}, nullptr)),
+#else
+                    : MaterializationUnit({{std::move(name), llvm::JITSymbolFlags::Exported |
+                                                             llvm::JITSymbolFlags::Callable}}, nullptr),
+#endif
+                      layer(layer), dataLayout(dataLayout), generate(std::move(generate)) {}
+
+            llvm::StringRef getName() const override {
+                return "LazyFunction";
+            }
+
+            void materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility> responsibility) override {
+                llvm::orc::ThreadSafeModule module;
+                try {
+                    module = generate();
+                } catch (const Utility::FirestormError &error) {
+                    layer.getExecutionSession().reportError(
+                            llvm::make_error<llvm::StringError>(error.what(), llvm::inconvertibleErrorCode()));
+                    responsibility->failMaterialization();
+                    return;
+                }
+
+                // Globals of the module besides the function, e.g. caches of memoized functions, are defined with it,
+                // so that its code refers to them rather than looking them up
+                llvm::orc::MangleAndInterner mangle(layer.getExecutionSession(), dataLayout);
+                llvm::orc::SymbolFlagsMap globals;
+                module.withModuleDo([&](llvm::Module &m) {
+                    m.setDataLayout(dataLayout);
+                    for (auto &global: m.global_values()) {
+                        if (global.isDeclarationForLinker() || global.hasLocalLinkage()) continue;
+                        auto name = mangle(global.getName());
+                        if (!responsibility->getSymbols().count(name)) {
+                            globals[name] = llvm::JITSymbolFlags::fromGlobalValue(global);
+                        }
+                    }
+                });
+                if (auto error = responsibility->defineMaterializing(std::move(globals))) {
+                    layer.getExecutionSession().reportError(std::move(error));
+                    responsibility->failMaterialization();
+                    return;
+                }
+                layer.emit(std::move(responsibility), std::move(module));
+            }
+        };
+
+        /// @brief Makes func count its calls, and call onHot with function when the count reaches threshold.
+        void countCalls(llvm::Function &func, void *function, void (*onHot)(void *), std::uint64_t threshold) {
+            auto &context = func.getContext();
+            auto &module = *func.getParent();
+            llvm::IRBuilder<> builder(context);
+
+            auto counter = new llvm::GlobalVariable(module, builder.getInt64Ty(), false,
+                                                    llvm::GlobalValue::PrivateLinkage, builder.getInt64(0),
+                                                    func.getName() + ".calls");
+            auto body = &func.getEntryBlock();
+            auto entry = llvm::BasicBlock::Create(context, "count", &func, body);
+            auto notify = llvm::BasicBlock::Create(context, "hot", &func, body);
+
+            // The callback is in this process, so it is called by address
+            builder.SetInsertPoint(entry);
+            auto count = builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, counter, builder.getInt64(1),
+                                                 llvm::MaybeAlign(8), llvm::AtomicOrdering::Monotonic);
+            builder.CreateCondBr(builder.CreateICmpEQ(count, builder.getInt64(threshold - 1)), notify, body);
+
+            builder.SetInsertPoint(notify);
+            auto type = llvm::FunctionType::get(builder.getVoidTy(), {builder.getInt8PtrTy()}, false);
+            auto callee = llvm::ConstantExpr::getIntToPtr(builder.getInt64((std::uintptr_t) onHot),
+                                                          type->getPointerTo());
+            auto argument = llvm::ConstantExpr::getIntToPtr(builder.getInt64((std::uintptr_t) function),
+                                                            builder.getInt8PtrTy());
+            builder.CreateCall(type, callee, {argument});
+            builder.CreateBr(body);
+        }
+    }
+
+    void initialiseNativeTarget() {
+        // The target registry is global, and not synchronised by LLVM
+        static std::once_flag once;
+        std::call_once(once, [] {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+    }
+
+    JIT::JIT(std::optional<TieringOptions> tiering, llvm::ObjectCache *cache) : tiering(std::move(tiering)) {
+        initialiseNativeTarget();
+
+        llvm::orc::LLJITBuilder builder;
+        if (!this->tiering && cache) {
+            builder.setCompileFunctionCreator([cache](llvm::orc::JITTargetMachineBuilder machine)
+                                                      -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+                auto target = machine.createTargetMachine();
+                if (!target) return target.takeError();
+                return std::make_unique<llvm::orc::TMOwningSimpleCompiler>(std::move(*target), cache);
+            });
+        } else if (this->tiering) {
+            // Hot functions are compiled on another thread, so every compilation needs a TargetMachine of its own
+            builder.setCompileFunctionCreator([](llvm::orc::JITTargetMachineBuilder machine)
+                                                      -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+                return std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(machine));
+            });
+        }
+        jit = check(builder.create());
+        auto &library = jit->getMainJITDylib();
+
+        // Lazy functions fail when they are called, so their errors are reported by the session rather than thrown
+        jit->getExecutionSession().setErrorReporter([this](llvm::Error error) {
+            llvm::errs() << "Error: " << llvm::toString(std::move(error)) << "\n";
+            failed = true;
+        });
+
+        // The runtime is linked into this executable, but its symbols are not necessarily exported
+        llvm::orc::SymbolMap runtime;
+        auto add = [&](const char *name, auto function) {
+            runtime[jit->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(
+                    llvm::pointerToJITTargetAddress(function), llvm::JITSymbolFlags::Exported);
+        };
+        add("putd", &putd);
+        add("putchard", &putchard);
+        add("firestorm_register_memo", &firestorm_register_memo);
+        add("firestorm_register_profile", &firestorm_register_profile);
+        check(library.define(llvm::orc::absoluteSymbols(std::move(runtime))));
+
+        // Everything else that extern declares is looked up in the process
+        auto prefix = jit->getDataLayout().getGlobalPrefix();
+        library.addGenerator(check(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix)));
+
+        if (this->tiering) {
+            stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(jit->getTargetTriple())();
+            recompiler = std::thread([this] { recompileHotFunctions(); });
+        }
+    }
+
+    JIT::~JIT() {
+        if (!recompiler.joinable()) return;
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        hot.notify_all();
+        recompiler.join();
+    }
+
+    void JIT::addFunction(llvm::orc::ThreadSafeModule module) {
+        if (tiering) return addTieredFunction(std::move(module));
+        addModule(std::move(module));
+    }
+
+    void JIT::addTieredFunction(llvm::orc::ThreadSafeModule module) {
+        TieredFunction *function;
+        std::string name;
+        module.withModuleDo([&](llvm::Module &m) {
+            auto &func = getDefinedFunction(m);
+            name = func.getName().str();
+            {
+                std::lock_guard lock(mutex);
+                function = &functions.emplace_back(TieredFunction{this, name});
+            }
+
+            // Keep the function as it is, before it counts its calls
+            llvm::raw_svector_ostream out(function->bitcode);
+            llvm::WriteBitcodeToFile(m, out);
+
+            // The stub takes the name of the function, so that recursive calls reach the hot code too
+            auto stub = llvm::Function::Create(func.getFunctionType(), llvm::Function::ExternalLinkage, "", m);
+            func.replaceAllUsesWith(stub);
+            func.setName(name + ".tier0");
+            stub->setName(name);
+
+            countCalls(func, function, &JIT::onHot, tiering->threshold);
+        });
+
+        // The stub is defined before the code, which calls it
+        check(stubs->createStub(name, 0, llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable));
+        llvm::orc::SymbolMap symbols;
+        symbols[jit->mangleAndIntern(name)] = stubs->findStub(name, true);
+        check(jit->getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols))));
+
+        addModule(std::move(module));
+        check(stubs->updatePointer(name, llvm::pointerToJITTargetAddress(lookup(name + ".tier0"))));
+    }
+
+    void JIT::onHot(void *data) {
+        auto function = (TieredFunction *) data;
+        auto jit = function->jit;
+        {
+            std::lock_guard lock(jit->mutex);
+            jit->hotFunctions.push_back(function);
+        }
+        jit->hot.notify_one();
+    }
+
+    void JIT::recompileHotFunctions() {
+        AST::Optimiser optimiser(tiering->optimiser);
+
+        std::unique_lock lock(mutex);
+        while (true) {
+            hot.wait(lock, [&] { return stopping || !hotFunctions.empty(); });
+            if (stopping) return;
+            auto &function = *hotFunctions.front();
+            hotFunctions.pop_front();
+            lock.unlock();
+
+            try {
+                auto context = std::make_unique<llvm::LLVMContext>();
+                auto module = check(llvm::parseBitcodeFile(
+                        llvm::MemoryBufferRef(llvm::StringRef(function.bitcode.data(), function.bitcode.size()),
+                                              function.name), *context));
+
+                // Recursive calls stay in the recompiled code, while globals, e.g. caches of memoized functions,
+                // are shared with the first tier
+                auto &func = getDefinedFunction(*module);
+                for (auto &global: module->globals()) {
+                    if (global.hasLocalLinkage()) continue;
+                    global.setInitializer(nullptr);
+                    global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+                }
+                func.setName(function.name + ".tier1");
+                optimiser.run(*module);
+
+                addModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)));
+                auto address = lookup(function.name + ".tier1");
+                check(stubs->updatePointer(function.name, llvm::pointerToJITTargetAddress(address)));
+            } catch (const Utility::FirestormError &) {
+                // The function keeps running its quickly compiled code
+            }
+
+            lock.lock();
+        }
+    }
+
+    void JIT::addLazyFunction(const std::string &name, FunctionGenerator generate) {
+        auto &session = jit->getExecutionSession();
+        if (!lazyLibrary) {
+            // Lazy functions call everything through the main library, so that calls of other lazy functions go
+            // through their stubs, rather than materialising them along with the caller
+            lazyLibrary = &session.createBareJITDylib("lazy");
+            lazyLibrary->setLinkOrder({{&jit->getMainJITDylib(), llvm::orc::JITDylibLookupFlags::MatchAllSymbols}},
+                                      false);
+            callThrough = check(llvm::orc::createLocalLazyCallThroughManager(
+                    jit->getTargetTriple(), session, llvm::pointerToJITTargetAddress(&failLazyCall)));
+            if (!stubs) stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(jit->getTargetTriple())();
+        }
+
+        auto symbol = jit->mangleAndIntern(name);
+        check(lazyLibrary->define(std::make_unique<LazyFunctionUnit>(
+                jit->getIRTransformLayer(), jit->getDataLayout(), symbol, std::move(generate))));
+
+        // Callers in the main library reach the function through a stub, which materialises it on the first call
+        llvm::orc::SymbolAliasMap aliases;
+        aliases[symbol] = {symbol, llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable};
+        check(jit->getMainJITDylib().define(
+                llvm::orc::lazyReexports(*callThrough, *stubs, *lazyLibrary, std::move(aliases))));
+    }
+
+    llvm::orc::ResourceTrackerSP JIT::addModule(llvm::orc::ThreadSafeModule module) {
+        auto tracker = jit->getMainJITDylib().createResourceTracker();
+        check(jit->addIRModule(tracker, std::move(module)));
+        return tracker;
+    }
+
+    void *JIT::lookup(const std::string &name) {
+        auto symbol = check(jit->lookup(name));
+        return llvm::jitTargetAddressToPointer<void *>(symbol.getAddress());
+    }
+
+    void JIT::addObject(std::unique_ptr<llvm::MemoryBuffer> object) {
+        check(jit->addObjectFile(std::move(object)));
+    }
+
+    double JIT::evaluate(llvm::orc::ThreadSafeModule module, const std::string &name) {
+        return call(addModule(std::move(module)), name);
+    }
+
+    double JIT::evaluate(std::unique_ptr<llvm::MemoryBuffer> object, const std::string &name) {
+        auto tracker = jit->getMainJITDylib().createResourceTracker();
+        check(jit->addObjectFile(tracker, std::move(object)));
+        return call(tracker, name);
+    }
+
+    double JIT::call(const llvm::orc::ResourceTrackerSP &tracker, const std::string &name) {
+        // The code is removed even if it fails to compile, so that the name can be used again
+        double value;
+        try {
+            value = ((double (*)()) lookup(name))();
+        } catch (const Utility::FirestormError &) {
+            check(tracker->remove());
+            throw;
+        }
+        check(tracker->remove());
+        return value;
+    }
+}
@@ -3,69 +3,102 @@
 //
 #include "Firestorm/custom_exceptions.hpp"
 #include "Firestorm/lexer.hpp"
+#include "Firestorm/scan.hpp"
+#include "Firestorm/symbol.hpp"
 
 #include <algorithm>
 #include <fmt/format.h>
 #include <map>
-#include <regex>
 
 namespace Firestorm::Lexing {
     [[maybe_unused]]
     std::string Token::toString() const {
-        std::string msg = "Token(type={}, value={}, index={}, lineno={}, colno={})";
-        return fmt::format(msg, getType(), value, position.index, position.lineno, position.colno);
+        std::string msg = "Token(type={}, value={}, index={})";
+        return fmt::format(msg, getType(), value, index);
     }
 
-    const std::vector<std::pair<Type, std::regex>> &getRuleSet() {
-        static std::vector<std::pair<Type, std::regex>> rule_set;
-
-        // Avoid multiple creation of rule set
-        static bool already = false;
-        if (already) return rule_set;
-        else already = true;
-
-        // I. Keywords
-        // Since these are keywords, the pattern needs to match only if there
-        // are whitespaces after them
-        // 1. If statement
-        rule_set.emplace_back(Type::If, std::regex("^if(?=\\s+)"));
-        rule_set.emplace_back(Type::Then, std::regex("^then(?=\\s+)"));
-        rule_set.emplace_back(Type::Else, std::regex("^else(?=\\s+)"));
-
-        // 2. For loop
-        rule_set.emplace_back(Type::For, std::regex("^for(?=\\s+)"));
-        // "then" is already present
-
-        // 3. Function declaration
-        rule_set.emplace_back(Type::Define, std::regex("^define(?=\\s+)"));
-
-        // 4. External symbol
-        rule_set.emplace_back(Type::Extern, std::regex("^extern(?=\\s+)"));
-
-        // II. Literals
-        // 1. Numbers
-        rule_set.emplace_back(Type::Number, std::regex(R"(^\d+(?:\.\d+)?)"));
-
-        // III. Operators
-        // 1. Arithmetic operators
-        rule_set.emplace_back(Type::Plus, std::regex("^\\+"));
-        rule_set.emplace_back(Type::Minus, std::regex("^-"));
-        rule_set.emplace_back(Type::Times, std::regex("^\\*"));
-        rule_set.emplace_back(Type::Divide, std::regex("^/"));
-
-        // 2. Comparison operators
-        rule_set.emplace_back(Type::Equ, std::regex("^=="));
-        rule_set.emplace_back(Type::Lt, std::regex("^<"));
-
-        // IV. Miscellaneous tokens
-        rule_set.emplace_back(Type::Equals, std::regex("^="));
-        rule_set.emplace_back(Type::Lparen, std::regex("^\\("));
-        rule_set.emplace_back(Type::Rparen, std::regex("^\\)"));
-        rule_set.emplace_back(Type::Comma, std::regex("^,"));
-        rule_set.emplace_back(Type::Semicolon, std::regex("^;"));
-        rule_set.emplace_back(Type::Id, std::regex("^[_a-zA-Z][_a-zA-Z0-9]*"));
-
-        return rule_set;
+    namespace {
+        /// @brief Character classes used by the scanner.
+        enum CharClass : unsigned char {
+            Other = 0,
+            Digit = 1 << 0,
+            IdStart = 1 << 1,
+            IdRest = 1 << 2,
+            Space = 1 << 3,
+        };
+
+        /// @brief Maps every byte to its CharClass bits.
+        struct CharTable {
+            unsigned char classes[256]{};
+
+            constexpr CharTable() {
+                for (int c = '0'; c <= '9'; ++c) classes[c] = Digit | IdRest;
+                for (int c = 'a'; c <= 'z'; ++c) classes[c] = IdStart | IdRest;
+                for (int c = 'A'; c <= 'Z'; ++c) classes[c] = IdStart | IdRest;
+                classes[(unsigned char) '_'] = IdStart | IdRest;
+
+                // Same set as \s in the former regex rules, since keywords require one after them
+                for (auto c: {' ', '\t', '\n', '\v', '\f', '\r'}) classes[(unsigned char) c] = Space;
+            }
+
+            [[nodiscard]]
+            constexpr bool is(char c, CharClass k) const { return classes[(unsigned char) c] & k; }
+        };
+
+        constexpr CharTable charTable;
+
+        /// @brief Skips a run of characters of class k.
+        ///
+        /// @note Most runs in Firestorm code are only one or two characters long, so those are checked here
+        /// and only longer runs are handed to the vectorised kernel.
+        inline const char *skipRun(const char *begin, const char *end, CharClass k,
+                                   const char *(*kernel)(const char *, const char *)) {
+            if (begin == end || !charTable.is(*begin, k)) return begin;
+            if (++begin == end || !charTable.is(*begin, k)) return begin;
+            return kernel(begin + 1, end);
+        }
+
+        /// @brief Slot of keyword table, indexed by hashKeyword()
+        struct KeywordSlot {
+            const char *word = nullptr;
+            std::size_t length = 0;
+            Type type = Type::Id;
+        };
+
+        constexpr std::size_t hashKeyword(const char *word, std::size_t length) {
+            return ((unsigned char) word[0] + (unsigned char) word[length - 1] + length) & 15;
+        }
+
+        /// @brief Perfect hash table of all keywords. Every keyword lands in a distinct slot.
+        struct KeywordTable {
+            KeywordSlot slots[16]{};
+
+            constexpr KeywordTable() {
+                add("if", 2, Type::If);
+                add("then", 4, Type::Then);
+                add("else", 4, Type::Else);
+                add("for", 3, Type::For);
+                add("define", 6, Type::Define);
+                add("extern", 6, Type::Extern);
+            }
+
+        private:
+            constexpr void add(const char *word, std::size_t length, Type type) {
+                slots[hashKeyword(word, length)] = {word, length, type};
+            }
+        };
+
+        constexpr KeywordTable keywordTable;
+    }
+
+    Type getKeywordType(const char *word, std::size_t length) {
+        if (length == 0) return Type::Id;
+        const auto &slot = keywordTable.slots[hashKeyword(word, length)];
+        if (slot.length != length) return Type::Id;
+        for (std::size_t i = 0; i < length; ++i) {
+            if (slot.word[i] != word[i]) return Type::Id;
+        }
+        return slot.type;
     }
 
     const auto &getTypeName(Type type) {
@@ -99,77 +132,123 @@ namespace Firestorm::Lexing {
 
     Token TokenStream::getNextToken() {
         // Check if finished, return EOF token
-        if (index == source.length()) return currentToken = {Type::Eof, "EOF", {index, lineno, colno}};
-
-        // Get substring, ignoring already lexed
-        auto sub_str = source.substr(index, source.length() - index);
-
-        // Iterate over all rules
-        std::smatch match_info;
-        for (const auto &rule: lexer.rules) {
-            // Search substring against rule
-            if (std::regex_search(sub_str, match_info, rule.second)) {
-                // Get the matched string
-                auto matched = sub_str.substr(match_info.position(), match_info.length());
-
-                // Craft token
-                currentToken = {rule.first, matched, {index, lineno, colno}};
-
-                // Update position
-                updateSourcePos();
-
-                return currentToken;
-            }
-        }
-        // Throw an error when source doesn't match any rules
-        throw Utility::getError(Utility::LE, "[{}:{}] Unknown character '{}'", lineno, colno, sub_str[0]);
-    }
-
-    void TokenStream::updateSourcePos() {
-        // Increment index and colno by the length of the token
-        auto l = (long) currentToken.value.length();
-        index += l;
-        colno += l;
-
-        // Find the first character (from index) that is not a whitespace
-        auto first_non_ws = source.find_first_not_of(" \n", index);
-
-        // If there aren't any whitespaces, return
-        if (first_non_ws == index) return;
-
-        // Check if end of source, i.e. the rest are whitespaces
-        if (first_non_ws == std::string::npos) {
-            // Set line, column and index
-            index = (long) source.length();
-            lineno = std::count(source.begin(), source.end(), '\n') + 1;
-            colno = (long) (source.length() - source.rfind('\n') + 1);
-            return;
+        auto length = (long) source.length();
+        if (index == length) return currentToken = {Type::Eof, "EOF", index};
+
+        const auto *begin = source.data() + index;
+        const auto *end = source.data() + length;
+        const auto *cursor = begin;
+        auto type = Type::Eof;
+
+        switch (*cursor) {
+            // I. Literals
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                // Numbers, i.e. \d+(?:\.\d+)?
+                type = Type::Number;
+                cursor = skipRun(cursor + 1, end, Digit, kernels.skipDigits);
+                if (cursor + 1 < end && *cursor == '.' && charTable.is(cursor[1], Digit)) {
+                    cursor = skipRun(cursor + 2, end, Digit, kernels.skipDigits);
+                }
+                break;
+
+            // II. Operators
+            case '+':
+                type = Type::Plus;
+                ++cursor;
+                break;
+            case '-':
+                type = Type::Minus;
+                ++cursor;
+                break;
+            case '*':
+                type = Type::Times;
+                ++cursor;
+                break;
+            case '/':
+                type = Type::Divide;
+                ++cursor;
+                break;
+            case '<':
+                type = Type::Lt;
+                ++cursor;
+                break;
+            case '=':
+                // Either "==" or "="
+                type = Type::Equals;
+                if (++cursor != end && *cursor == '=') {
+                    type = Type::Equ;
+                    ++cursor;
+                }
+                break;
+
+            // III. Miscellaneous tokens
+            case '(':
+                type = Type::Lparen;
+                ++cursor;
+                break;
+            case ')':
+                type = Type::Rparen;
+                ++cursor;
+                break;
+            case ',':
+                type = Type::Comma;
+                ++cursor;
+                break;
+            case ';':
+                type = Type::Semicolon;
+                ++cursor;
+                break;
+
+            default:
+                // IV. Identifiers and keywords
+                if (!charTable.is(*cursor, IdStart)) {
+                    // Throw an error when source doesn't match any rules
+                    auto position = getPosition(index);
+                    throw Utility::getError(Utility::LE, "[{}:{}] Unknown character '{}'",
+                                            position.lineno, position.colno, *cursor);
+                }
+                cursor = skipRun(cursor + 1, end, IdRest, kernels.skipIdentifier);
+
+                // Keywords only count when whitespaces follow them
+                type = Type::Id;
+                if (cursor != end && charTable.is(*cursor, Space)) {
+                    type = getKeywordType(begin, cursor - begin);
+                }
+                break;
         }
 
-        // Substring to match against (from index to first non-whitespace)
-        auto sub_str = source.substr(index, first_non_ws - index);
+        // Craft token
+        std::string_view value(begin, cursor - begin);
+        currentToken = {type, value, index};
 
-        // Increment index by length of whitespaces
-        index += (long) sub_str.length();
+        // Identifiers are interned here once, so later stages only deal with symbols
+        if (type == Type::Id) currentToken.symbol = Utility::internSymbol(value);
 
-        // Check if there are newlines in substring
-        if (sub_str.find('\n') != std::string::npos) {
-            // Count the number of newline(s)
-            auto nl_count = std::count(sub_str.begin(), sub_str.end(), '\n');
+        // Update position
+        index += cursor - begin;
+        skipWhitespaces();
 
-            // Increment line number by the number of newline(s)
-            lineno += nl_count;
+        return currentToken;
+    }
 
-            // Find last newline in substring
-            auto last_nl = sub_str.rfind('\n');
+    void TokenStream::skipWhitespaces() {
+        const auto *begin = source.data();
+        index = skipRun(begin + index, begin + source.length(), Space, kernels.skipWhitespaces) - begin;
+    }
 
-            // Set column number to the number of whitespaces after the last newline
-            colno = (long) (sub_str.length() - last_nl);
-            return;
+    SourcePosition TokenStream::getPosition(long i) const {
+        // Record the start of every line once
+        if (lineOffsets.empty()) {
+            lineOffsets.reserve(kernels.countNewlines(source.data(), source.data() + source.length()) + 1);
+            lineOffsets.push_back(0);
+            for (auto nl = source.find('\n'); nl != std::string_view::npos; nl = source.find('\n', nl + 1)) {
+                lineOffsets.push_back((long) nl + 1);
+            }
         }
 
-        // Otherwise, if there aren't any newlines, update
-        // column according to length of substring
-        colno += (long) sub_str.length();
+        // The line containing i is the last one starting at or before it
+        auto line = std::upper_bound(lineOffsets.begin(), lineOffsets.end(), i) - 1;
+        return {i, line - lineOffsets.begin() + 1, i - *line + 1};
     }
 }
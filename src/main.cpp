@@ -1,9 +1,168 @@
 //
 // Created by Nguyen Thai Binh on 17/1/22.
 //
+#include "Firestorm/custom_exceptions.hpp"
 #include "Firestorm/frontend.hpp"
 
-int main() {
-    Firestorm::Frontend::Interpreter::run();
-    return 0;
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace {
+    int printUsage() {
+        std::cerr << "Usage: FirestormMain                              Start the REPL\n"
+                     "       FirestormMain file.fire                    Run a file\n"
+                     "       FirestormMain -emit-llvm file.fire         Print the LLVM IR of a file\n"
+                     "       FirestormMain [-c] [-o output] file.fire   Compile a file to an executable,\n"
+                     "                                                  or an object file with -c\n"
+                     "Options:\n"
+                     "       -O0, -O1, -O2, -O3, -Os                    Optimisation level, -O2 by default\n"
+                     "       -passes=pipeline                           Extra module passes, as for 'opt -passes'\n"
+                     "       -j[N]                                      Generate functions of a file on N threads,\n"
+                     "                                                  or one per core\n"
+                     "       -tiered                                    Run functions unoptimised first, and\n"
+                     "                                                  recompile hot ones at -O3 in the background\n"
+                     "       -vm                                        Run on the bytecode VM instead of the JIT\n"
+                     "       -lazy                                      Compile functions when they are first called\n"
+                     "       -fast-math[=flags]                         Set fast-math flags on all functions, i.e.\n"
+                     "                                                  all, or a list of reassoc, nnan, ninf, nsz,\n"
+                     "                                                  arcp, contract and afn\n"
+                     "       -memoize                                   Memoize pure functions that recurse more than\n"
+                     "                                                  once, besides those annotated with 'memo'\n"
+                     "       -memo-budget=N                             Cache size of memoized functions in bytes\n"
+                     "       -memo-stats                                Print the hit rate of memoized functions\n"
+                     "       -eval-fuel=N                               Evaluate pure calls with constant arguments\n"
+                     "                                                  at compile time in N steps at most, or never\n"
+                     "                                                  with 0\n"
+                     "       -eval-depth=N                              Nest N calls at most when evaluating them\n"
+                     "       -profile-generate=file                     Count calls and branches of functions, and\n"
+                     "                                                  write them to file when the program ends\n"
+                     "       -profile-use=file                          Optimise with the counts of a profile\n"
+                     "       -cache-dir=dir                             Keep compiled code in dir, and reuse it for\n"
+                     "                                                  unchanged functions and programs\n";
+        return 1;
+    }
+
+    /// @return The fast-math flags of a comma-separated list of their names, or 0 if a name is not a flag
+    std::uint8_t parseFastMathFlags(const std::string &names) {
+        std::uint8_t flags = 0;
+        std::size_t begin = 0;
+        while (true) {
+            auto end = std::min(names.find(',', begin), names.size());
+            auto flag = Firestorm::AST::getFastMathFlags(std::string_view(names).substr(begin, end - begin));
+            if (!flag) return 0;
+            flags |= flag;
+            if (end == names.size()) return flags;
+            begin = end + 1;
+        }
+    }
+
+    /// @return The value of a decimal count of at most 9 digits, or nothing if it isn't one
+    std::optional<std::uint32_t> parseCount(const std::string &digits) {
+        if (digits.empty() || digits.size() > 9 || digits.find_first_not_of("0123456789") != std::string::npos) {
+            return std::nullopt;
+        }
+        return (std::uint32_t) std::stoul(digits);
+    }
+}
+
+int main(int argc, char **argv) {
+    using Firestorm::AST::OptimisationLevel;
+
+    Firestorm::Frontend::Options options;
+    bool emitIR = false;
+    bool compile = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-emit-llvm") {
+            emitIR = true;
+        } else if (arg == "-c") {
+            options.objectOnly = compile = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            options.output = argv[++i];
+            compile = true;
+        } else if (arg == "-O0") {
+            options.optimiser.level = OptimisationLevel::O0;
+        } else if (arg == "-O1") {
+            options.optimiser.level = OptimisationLevel::O1;
+        } else if (arg == "-O2") {
+            options.optimiser.level = OptimisationLevel::O2;
+        } else if (arg == "-O3") {
+            options.optimiser.level = OptimisationLevel::O3;
+        } else if (arg == "-Os") {
+            options.optimiser.level = OptimisationLevel::Os;
+        } else if (arg.rfind("-passes=", 0) == 0) {
+            options.optimiser.extraPasses = arg.substr(8);
+        } else if (arg == "-vm") {
+            options.vm = true;
+        } else if (arg == "-lazy") {
+            options.lazy = true;
+        } else if (arg == "-tiered") {
+            options.tiered = true;
+        } else if (arg == "-fast-math") {
+            options.optimiser.fastMath = Firestorm::AST::FastMath::Fast;
+        } else if (arg.rfind("-fast-math=", 0) == 0) {
+            auto flags = parseFastMathFlags(arg.substr(11));
+            if (!flags) return printUsage();
+            options.optimiser.fastMath = flags;
+        } else if (arg == "-memoize") {
+            options.optimiser.memo.automatic = true;
+        } else if (arg.rfind("-memo-budget=", 0) == 0) {
+            auto count = parseCount(arg.substr(13));
+            if (!count) return printUsage();
+            options.optimiser.memo.budget = *count;
+        } else if (arg == "-memo-stats") {
+            options.optimiser.memo.stats = true;
+        } else if (arg.rfind("-eval-fuel=", 0) == 0) {
+            auto count = parseCount(arg.substr(11));
+            if (!count) return printUsage();
+            options.evaluation.fuel = *count;
+        } else if (arg.rfind("-eval-depth=", 0) == 0) {
+            auto count = parseCount(arg.substr(12));
+            if (!count) return printUsage();
+            options.evaluation.depth = *count;
+        } else if (arg.rfind("-profile-generate=", 0) == 0) {
+            options.optimiser.profile.generate = arg.substr(18);
+            if (options.optimiser.profile.generate.empty()) return printUsage();
+        } else if (arg.rfind("-profile-use=", 0) == 0) {
+            try {
+                options.optimiser.profile.use = Firestorm::AST::readProfile(arg.substr(13));
+            } catch (const Firestorm::Utility::FirestormError &error) {
+                std::cerr << "Error: " << error.what() << "\n";
+                return 1;
+            }
+        } else if (arg.rfind("-cache-dir=", 0) == 0) {
+            options.cacheDirectory = arg.substr(11);
+            if (options.cacheDirectory.empty()) return printUsage();
+        } else if (arg.rfind("-j", 0) == 0) {
+            // Without a number, every core is used
+            auto digits = arg.substr(2);
+            if (digits.find_first_not_of("0123456789") != std::string::npos || digits.size() > 4) {
+                return printUsage();
+            }
+            options.jobs = digits.empty() ? 0 : std::stoul(digits);
+        } else if (arg[0] != '-' && options.input.empty()) {
+            options.input = arg;
+        } else {
+            return printUsage();
+        }
+    }
+
+    // Lazy functions are compiled once, at the optimisation level of the JIT
+    if (options.lazy && options.tiered) return printUsage();
+
+    // Start the REPL if there is no file
+    if (options.input.empty()) {
+        if (emitIR || compile) return printUsage();
+        Firestorm::Frontend::Interpreter::run(options);
+        return 0;
+    }
+
+    if (emitIR) return Firestorm::Frontend::Compiler::emitIR(options) ? 0 : 1;
+    if (compile) return Firestorm::Frontend::Compiler::compile(options) ? 0 : 1;
+    return Firestorm::Frontend::Interpreter::runFile(options) ? 0 : 1;
 }
@@ -0,0 +1,87 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/optimiser.hpp"
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/Scalar/TailRecursionElimination.h>
+
+namespace Firestorm::AST {
+    namespace {
+        // The level of the new pass manager was moved out of PassBuilder in LLVM 14
+#if LLVM_VERSION_MAJOR >= 14
+        using PassLevel = llvm::OptimizationLevel;
+#else
+        using PassLevel = llvm::PassBuilder::OptimizationLevel;
+#endif
+
+        PassLevel getPassLevel(OptimisationLevel level) {
+            switch (level) {
+                case OptimisationLevel::O0:
+                    return PassLevel::O0;
+                case OptimisationLevel::O1:
+                    return PassLevel::O1;
+                case OptimisationLevel::O2:
+                    return PassLevel::O2;
+                case OptimisationLevel::O3:
+                    return PassLevel::O3;
+                case OptimisationLevel::Os:
+                    return PassLevel::Os;
+            }
+            return PassLevel::O2;
+        }
+    }
+
+    Optimiser::Optimiser(const OptimiserOptions &options, llvm::TargetMachine *machine, Pipeline pipeline)
+            : passBuilder(machine) {
+        for (auto &extension: options.extensions) extension(passBuilder);
+
+        // Firestorm has no mutable state, so loops are written as recursion, which O2 and above turn back into
+        // loops, but O1 would not. Recursion that accumulates into an operand of a call becomes a loop too, if
+        // the operation allows reassoc and nsz, as it changes the order of the operations
+        passBuilder.registerScalarOptimizerLateEPCallback([](llvm::FunctionPassManager &passes, PassLevel level) {
+            if (level == PassLevel::O1) passes.addPass(llvm::TailCallElimPass());
+        });
+
+        passBuilder.registerModuleAnalyses(moduleAnalyses);
+        passBuilder.registerCGSCCAnalyses(sccAnalyses);
+        passBuilder.registerFunctionAnalyses(functionAnalyses);
+        passBuilder.registerLoopAnalyses(loopAnalyses);
+        passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, sccAnalyses, moduleAnalyses);
+
+        // Interprocedural passes, e.g. inlining, interleaved with peephole, CFG, scalar and loop passes,
+        // e.g. instcombine, GVN, LICM and induction variable simplification
+        // O0 has a pipeline of its own, which only keeps what is required, e.g. always-inline
+        auto level = getPassLevel(options.level);
+        if (options.level == OptimisationLevel::O0) {
+            modulePasses = passBuilder.buildO0DefaultPipeline(level);
+        } else if (pipeline == Pipeline::Module) {
+            modulePasses = passBuilder.buildPerModuleDefaultPipeline(level);
+        } else {
+            // Only the entry point of executables is called from outside
+            modulePasses.addPass(llvm::InternalizePass([](const llvm::GlobalValue &value) {
+                return value.getName() == "main";
+            }));
+            modulePasses.addPass(passBuilder.buildLTODefaultPipeline(level, nullptr));
+        }
+
+        if (!options.extraPasses.empty()) {
+            if (auto error = passBuilder.parsePassPipeline(modulePasses, options.extraPasses)) {
+                throw Utility::getError(Utility::FE, "Invalid pass pipeline '{}': {}", options.extraPasses,
+                                        llvm::toString(std::move(error)));
+            }
+        }
+    }
+
+    void Optimiser::run(llvm::Module &module) {
+        modulePasses.run(module, moduleAnalyses);
+
+        // Results are cached by IR, which is changed by code generation later
+        loopAnalyses.clear();
+        functionAnalyses.clear();
+        sccAnalyses.clear();
+        moduleAnalyses.clear();
+    }
+}
@@ -0,0 +1,155 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/parallel.hpp"
+
+#include <algorithm>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Firestorm::AST {
+
+    ParallelCodeGenerator::ParallelCodeGenerator(CodeGenerator &codegen, const OptimiserOptions &options,
+                                                 unsigned threads) : codegen(codegen) {
+        if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned i = 0; i < threads; ++i) {
+            this->threads.emplace_back([this, options] { work(options); });
+        }
+    }
+
+    ParallelCodeGenerator::~ParallelCodeGenerator() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (auto &thread: threads) thread.join();
+    }
+
+    void ParallelCodeGenerator::work(const OptimiserOptions &options) {
+        // Every thread is a session of its own, reused for all of its jobs
+        CodeGenerator session(options);
+
+        // Modules of other threads are linked afterwards, and the whole program is optimised then
+        session.inlineAcrossModules = false;
+
+        std::unique_lock lock(mutex);
+        while (true) {
+            queued.wait(lock, [&] { return stopping || next < jobs.size(); });
+            if (next == jobs.size()) return;
+            auto &job = jobs[next++];
+            lock.unlock();
+
+            try {
+                session.signatures = std::move(job.signatures);
+                generateIR(session, job.program, job.function);
+                job.module = session.takeModule();
+            } catch (...) {
+                // Drop what was emitted of the function
+                job.error = std::current_exception();
+                session.startModule("Main");
+            }
+
+            lock.lock();
+            ++completed;
+            done.notify_all();
+        }
+    }
+
+    void ParallelCodeGenerator::define(Program program, ExprId function) {
+        const auto &proto = program.get<Prototype>(program.get<Function>(function).proto);
+        auto &signatures = codegen.signatures;
+
+        Job job{std::move(program), function};
+
+        // The function is declared by its own module, or again from an extern declaring it before
+        auto own = signatures.find(proto.name);
+        if (own != signatures.end()) {
+            if (own->second.defined) {
+                throw Utility::getError(Utility::CE, "Function '{}' cannot be redefined",
+                                        Utility::getSymbolName(proto.name));
+            }
+            job.signatures.insert(*own);
+        }
+
+        // Resolve calls now, so that threads never read the signatures of codegen
+        for (const auto &call: job.program.calls) {
+            if (call.callee == proto.name) continue;
+            auto callee = signatures.find(call.callee);
+            if (callee == signatures.end()) {
+                throw Utility::getError(Utility::CE, "Unknown function '{}'",
+                                        Utility::getSymbolName(call.callee));
+            }
+            job.signatures.insert(*callee);
+        }
+
+        // Later functions and statements call it from now on
+        auto &signature = signatures[proto.name];
+        if (own == signatures.end()) {
+            auto args = job.program.getArgs(proto);
+            signature.parameters.assign(args.begin(), args.end());
+        }
+        signature.defined = true;
+        signature.pure = isPureFunction(codegen, job.program, function);
+
+        {
+            std::lock_guard lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        queued.notify_one();
+    }
+
+    std::vector<llvm::orc::ThreadSafeModule> ParallelCodeGenerator::finish() {
+        std::unique_lock lock(mutex);
+        done.wait(lock, [&] { return completed == jobs.size(); });
+
+        std::vector<llvm::orc::ThreadSafeModule> modules;
+        std::exception_ptr error;
+        for (auto &job: jobs) {
+            if (job.error) {
+                error = job.error;
+                break;
+            }
+            modules.push_back(std::move(job.module));
+        }
+        jobs.clear();
+        next = completed = 0;
+
+        if (error) std::rethrow_exception(error);
+        return modules;
+    }
+
+    void linkModules(CodeGenerator &codegen, std::vector<llvm::orc::ThreadSafeModule> modules) {
+        auto &destination = *codegen.module;
+        llvm::Linker linker(destination);
+        for (auto &module: modules) {
+            llvm::SmallVector<char, 0> bitcode;
+            module.withModuleDo([&](llvm::Module &source) {
+                llvm::raw_svector_ostream out(bitcode);
+                llvm::WriteBitcodeToFile(source, out);
+            });
+
+            // The module and its context are no longer needed
+            module = {};
+
+            auto source = llvm::parseBitcodeFile(
+                    llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()), "function"),
+                    *codegen.context);
+            if (!source) {
+                throw Utility::getError(Utility::BE, "Cannot read module: {}", llvm::toString(source.takeError()));
+            }
+
+            // Functions are generated without a target, which destination may have been given already
+            (*source)->setDataLayout(destination.getDataLayout());
+            (*source)->setTargetTriple(destination.getTargetTriple());
+            if (linker.linkInModule(std::move(*source))) {
+                throw Utility::getError(Utility::BE, "Cannot link the module of a function");
+            }
+        }
+    }
+}
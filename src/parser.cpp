@@ -6,290 +6,321 @@
 #include "Firestorm/lexer.hpp"
 #include "Firestorm/parser.hpp"
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
 #include <memory>
 #include <vector>
 
 namespace Firestorm::Parsing {
-    Utility::FirestormError getError(const std::string &msg, const Lexing::Token &token) {
-        auto l = token.position.lineno;
-        auto c = token.position.colno;
+    Utility::FirestormError getError(const std::string &msg, const Lexing::TokenStream &stream,
+                                     const Lexing::Token &token) {
+        // Line and column are only resolved here, when a diagnostic needs them
+        auto position = stream.getPosition(token.index);
+        auto l = position.lineno;
+        auto c = position.colno;
         auto v = token.value;
         return Utility::getError(Utility::PE, msg, l, c, v);
     }
 
-    int Parser::getOperatorPrecedence() {
-        auto p = precedence_table[stream.currentToken.value];
-        if (p > 0) return p;
-        return -1;
+    Utility::FirestormError getError(const std::string &msg, const Lexing::TokenStream &stream) {
+        return getError(msg, stream, stream.currentToken);
     }
 
-    std::map<std::string, int> &getPrecedenceTable() {
-        static std::map<std::string, int> table;
-
-        // Avoid multiple creation of table
-        static bool already = false;
-        if (already) return table;
-        else already = true;
-
-        table["=="] = 100;
-        table["!="] = 100;
-        table[">="] = 100;
-        table["<="] = 100;
-        table[">"] = 100;
-        table["<"] = 100;
+    ExprPtr Parser::parseNumExpr() {
+        // Convert token value to double
+        // The token is a view into source, hence not null-terminated
+        double value;
+        llvm::StringRef(stream.currentToken.value.data(), stream.currentToken.value.size()).getAsDouble(value);
 
-        table["+"] = 200;
-        table["-"] = 200;
-        table["*"] = 300;
-        table["/"] = 300;
+        // Consume the token
+        stream.getNextToken();
+        return program->add(AST::NumberExpr{value});
+    }
 
-        return table;
+    void Parser::openFrame(Frame::Kind kind, Utility::Symbol name) {
+        frames.push_back({kind, (std::uint32_t) operators.size(), name, (std::uint32_t) arguments.size()});
     }
 
-    ExprPtr Parser::parseForExpr() {
-        // Consume FOR token and check for ID that followed
-        if (stream.getNextToken().type != Lexing::Type::Id) {
-            throw getError("[{}:{}] Expected an identifier, found '{}'", stream.currentToken);
+    void Parser::reduceOperators(std::uint32_t base, const AST::OperatorInfo &op) {
+        while (operators.size() > base) {
+            // Pending operators that bind more tightly than op take their operands first
+            // Of the same precedence, the previous is taken first unless op is right-associative
+            auto pending = AST::getOperatorInfo(operators.back());
+            if (pending.precedence < op.precedence) return;
+            if (pending.precedence == op.precedence && op.associativity == AST::Associativity::Right) return;
+
+            auto rhs = operands.back();
+            operands.pop_back();
+            auto lhs = operands.back();
+            operands.pop_back();
+            operands.push_back(program->add(AST::BinaryExpr{lhs, operators.back(), rhs}));
+            operators.pop_back();
         }
+    }
 
-        // Get variable name
-        auto var = stream.currentToken.value;
+    ExprPtr Parser::parseExpr() {
+        frames.clear();
+        operands.clear();
+        operators.clear();
+        arguments.clear();
+        openFrame(Frame::Kind::Root);
 
-        // Consume ID and check for EQUALS
-        if (stream.getNextToken().type != Lexing::Type::Equals) {
-            throw getError("[{}:{}] Expected '=' after name in for loop, found '{}'", stream.currentToken);
-        }
+        // Keep looping to parse the entire expression
+        while (true) {
+            // If the primary opened a frame, its nested expression starts with another primary
+            if (!parsePrimary()) continue;
 
-        // Consume EQUALS
-        stream.getNextToken();
+            // Otherwise, the primary is followed by either a BinOp or the end of the innermost expression
+            while (true) {
+                auto op = AST::getOperatorInfo(stream.currentToken.type);
+                if (op.precedence >= 0) {
+                    // Combine the pending BinOps that bind more tightly, then wait for the rhs of this one
+                    reduceOperators(frames.back().operatorBase, op);
+                    operators.push_back((AST::Operator) stream.currentToken.type);
+
+                    // Consume the operator
+                    stream.getNextToken();
+                    break;
+                }
 
-        // Parse start value
-        auto start = parseExpr();
-        if (!start) return nullptr;
+                // The innermost expression ends here, so combine all of its BinOps
+                // An operator with precedence -1 is never taken by reduceOperators, hence a lower one is used
+                reduceOperators(frames.back().operatorBase, {-2});
+                auto value = operands.back();
+                operands.pop_back();
 
-        // Check for COMMA
-        if (stream.currentToken.type != Lexing::Type::Comma) {
-            throw getError("[{}:{}] Expected ',' after start in for loop, found '{}'", stream.currentToken);
+                if (frames.back().kind == Frame::Kind::Root) {
+                    frames.pop_back();
+                    return value;
+                }
+                if (!closeFrame(value)) break;
+            }
         }
+    }
 
-        // Consume COMMA
-        stream.getNextToken();
-
-        // Parse end value
-        auto end = parseExpr();
-        if (!end) return nullptr;
-
-        // Check for optional step expr
-        // By checking for comma
-        ExprPtr step;
-        if (stream.currentToken.type == Lexing::Type::Comma) {
-            // Consume comma
-            stream.getNextToken();
+    bool Parser::parsePrimary() {
+        switch (stream.currentToken.type) {
+            case Lexing::Type::Number:
+                operands.push_back(parseNumExpr());
+                return true;
+
+            case Lexing::Type::Id: {
+                // Get identifier type
+                auto id = stream.currentToken.symbol;
+
+                // Check if next token is LPAREN
+                if (stream.getNextToken().type != Lexing::Type::Lparen) {
+                    // If not, then simple variable
+                    operands.push_back(program->add(AST::VariableExpr{id}));
+                    return true;
+                }
 
-            // Parse step value
-            step = parseExpr();
-            if (!step) return nullptr;
-        }
+                // If reach here, then it is function call
+                // Consume LPAREN and check for RPAREN
+                if (stream.getNextToken().type == Lexing::Type::Rparen) {
+                    // Consume RPAREN
+                    stream.getNextToken();
+                    auto first = (std::uint32_t) program->arguments.size();
+                    operands.push_back(program->add(AST::CallExpr{id, first, 0}));
+                    return true;
+                }
 
-        // Check and consume THEN
-        if (stream.currentToken.type != Lexing::Type::Then) {
-            throw getError("[{}:{}] Expected 'then' in for loop, found '{}'", stream.currentToken);
-        }
-        stream.getNextToken();
+                // Not RPAREN -> Function call with arguments, starting with the first one
+                openFrame(Frame::Kind::CallArg, id);
+                return false;
+            }
 
-        // Parse body
-        auto body = parseExpr();
-        if (!body) return nullptr;
+            case Lexing::Type::Lparen:
+                // Consume LPAREN token
+                stream.getNextToken();
+                openFrame(Frame::Kind::Paren);
+                return false;
 
-        return std::make_unique<AST::ForExpr>(var, std::move(start), std::move(end),
-                                              std::move(step), std::move(body));
-    }
+            case Lexing::Type::If:
+                // Consume IF token
+                stream.getNextToken();
+                openFrame(Frame::Kind::IfCond);
+                return false;
 
-    ExprPtr Parser::parseIfExpr() {
-        // Consume IF token
-        stream.getNextToken();
+            case Lexing::Type::For: {
+                // Consume FOR token and check for ID that followed
+                if (stream.getNextToken().type != Lexing::Type::Id) {
+                    throw getError("[{}:{}] Expected an identifier, found '{}'", stream);
+                }
 
-        // Parse condition_clause
-        auto cond = parseExpr();
-        if (!cond) return nullptr;
+                // Get variable name
+                auto var = stream.currentToken.symbol;
 
-        // Check for and consume THEN token
-        if (stream.currentToken.type != Lexing::Type::Then) {
-            throw getError("[{}:{}] Expected 'then', found '{}'", stream.currentToken);
-        }
-        stream.getNextToken();
+                // Consume ID and check for EQUALS
+                if (stream.getNextToken().type != Lexing::Type::Equals) {
+                    throw getError("[{}:{}] Expected '=' after name in for loop, found '{}'", stream);
+                }
 
-        // Parse then_clause
-        auto then = parseExpr();
-        if (!then) return nullptr;
+                // Consume EQUALS
+                stream.getNextToken();
+                openFrame(Frame::Kind::ForStart, var);
+                return false;
+            }
 
-        // Check for and consume ELSE token
-        if (stream.currentToken.type != Lexing::Type::Else) {
-            throw getError("[{}:{}] Expected 'else', found '{}'", stream.currentToken);
+            default:
+                throw getError("[{}:{}] Expected an expression, found '{}'", stream);
         }
-        stream.getNextToken();
-
-        // Parse then_clause
-        auto _else = parseExpr();
-        if (!_else) return nullptr;
-
-        return std::make_unique<AST::IfExpr>(std::move(cond), std::move(then), std::move(_else));
     }
 
-    ExprPtr Parser::parseNumExpr() {
-        // Convert token value to double
-        auto value = std::strtod(stream.currentToken.value.c_str(), nullptr);
+    bool Parser::closeFrame(ExprPtr value) {
+        auto &frame = frames.back();
+        auto type = stream.currentToken.type;
 
-        // Consume the token
-        stream.getNextToken();
-        return std::move(std::make_unique<AST::NumberExpr>(value));
-    }
+        switch (frame.kind) {
+            case Frame::Kind::Paren:
+                // Check for matching RPAREN
+                if (type != Lexing::Type::Rparen) {
+                    throw getError("[{}:{}] Expected ')', found '{}'", stream);
+                }
 
-    ExprPtr Parser::parseParenExpr() {
-        // Consume LPAREN token
-        stream.getNextToken();
+                // Consume RPAREN token
+                stream.getNextToken();
+                frames.pop_back();
+                operands.push_back(value);
+                return true;
 
-        // Parse expr
-        auto value = parseExpr();
-        if (!value) return nullptr;
+            case Frame::Kind::CallArg: {
+                arguments.push_back(value);
 
-        // Check for matching RPAREN
-        if (stream.currentToken.type != Lexing::Type::Rparen) {
-            throw getError("[{}:{}] Expected ')', found '{}'", stream.currentToken);
-        }
+                // Check for COMMA, then the next argument follows
+                if (type == Lexing::Type::Comma) {
+                    stream.getNextToken();
+                    return false;
+                }
 
-        // Consume RPAREN token
-        stream.getNextToken();
-        return value;
-    }
+                // Check if not RPAREN then raise error
+                if (type != Lexing::Type::Rparen) {
+                    throw getError("[{}:{}] Expected ')' or ',', found '{}'", stream);
+                }
 
-    ExprPtr Parser::parseIdExpr() {
-        // Get identifier type
-        std::string id = stream.currentToken.value;
+                // Consume RPAREN
+                stream.getNextToken();
 
-        // Check if next token is LPAREN
-        if (stream.getNextToken().type != Lexing::Type::Lparen) {
-            // If not, then simple variable
-            return std::make_unique<AST::VariableExpr>(id);
-        }
+                // The arguments of the call are the last pending ones, as nested calls have already ended
+                auto first = (std::uint32_t) program->arguments.size();
+                auto count = (std::uint32_t) arguments.size() - frame.argumentBase;
+                program->arguments.insert(program->arguments.end(), arguments.end() - count, arguments.end());
+                arguments.resize(frame.argumentBase);
 
-        // If reach here, then it is function call
-        // Consume LPAREN and check for RPAREN
-        std::vector<ExprPtr> args;
-        if (stream.getNextToken().type != Lexing::Type::Rparen) {
-            // Not RPAREN -> Function call with arguments
-            // Loop to get all arguments
-            while (true) {
-                auto arg = parseExpr();
-                if (!arg) return nullptr;
-                args.push_back(std::move(arg));
-
-                // Check for RPAREN
-                // then break this loop
-                if (stream.currentToken.type == Lexing::Type::Rparen) break;
+                auto call = program->add(AST::CallExpr{frame.name, first, count});
+                frames.pop_back();
+                operands.push_back(call);
+                return true;
+            }
 
-                // Check if not comma then raise error
-                if (stream.currentToken.type != Lexing::Type::Comma) {
-                    throw getError("[{}:{}] Expected ')' or ',', found '{}'", stream.currentToken);
+            case Frame::Kind::IfCond:
+                // Check for and consume THEN token
+                if (type != Lexing::Type::Then) {
+                    throw getError("[{}:{}] Expected 'then', found '{}'", stream);
+                }
+                stream.getNextToken();
+                frame.clauses[0] = value;
+                frame.kind = Frame::Kind::IfThen;
+                return false;
+
+            case Frame::Kind::IfThen:
+                // Check for and consume ELSE token
+                if (type != Lexing::Type::Else) {
+                    throw getError("[{}:{}] Expected 'else', found '{}'", stream);
                 }
-
-                // Consume COMMA token
                 stream.getNextToken();
+                frame.clauses[1] = value;
+                frame.kind = Frame::Kind::IfElse;
+                return false;
+
+            case Frame::Kind::IfElse: {
+                auto expr = program->add(AST::IfExpr{frame.clauses[0], frame.clauses[1], value});
+                frames.pop_back();
+                operands.push_back(expr);
+                return true;
             }
-        }
 
-        // Consume RPAREN
-        stream.getNextToken();
-        return std::make_unique<AST::CallExpr>(id, std::move(args));
-    }
-
-    ExprPtr Parser::parsePrimary() {
-        // This method is self-explanatory
-        auto type = stream.currentToken.type;
-        if (type == Lexing::Type::Number) {
-            return parseNumExpr();
-        } else if (type == Lexing::Type::Lparen) {
-            return parseParenExpr();
-        } else if (type == Lexing::Type::Id) {
-            return parseIdExpr();
-        } else if (type == Lexing::Type::If) {
-            return parseIfExpr();
-        } else if (type == Lexing::Type::For) {
-            return parseForExpr();
-        } else {
-            throw getError("[{}:{}] Expected an expression, found '{}'", stream.currentToken);
-        }
-    }
-
-    ExprPtr Parser::parseExpr() {
-        // Get LHS
-        auto lhs = parsePrimary();
-        if (!lhs) return nullptr;
-        auto v = parseBinOpRHS(0, std::move(lhs));
-        return v;
-    }
-
-    ExprPtr Parser::parseBinOpRHS(int exprPre, ExprPtr lhs) {
-        // Keep looping to parse the entire expression
-        while (true) {
-            // Get token exprPre
-            auto currentPre = getOperatorPrecedence();
-
-            // If token is not a BinOp, currentPre is -1
-            // If token is a BinOp that has strictly smaller
-            // exprPre than current exprPre, then return LHS
-            if (currentPre < exprPre) return lhs;
+            case Frame::Kind::ForStart:
+                // Check for and consume COMMA
+                if (type != Lexing::Type::Comma) {
+                    throw getError("[{}:{}] Expected ',' after start in for loop, found '{}'", stream);
+                }
+                stream.getNextToken();
+                frame.clauses[0] = value;
+                frame.kind = Frame::Kind::ForEnd;
+                return false;
+
+            case Frame::Kind::ForEnd:
+                frame.clauses[1] = value;
+
+                // Check for optional step expr
+                // By checking for comma
+                if (type == Lexing::Type::Comma) {
+                    stream.getNextToken();
+                    frame.kind = Frame::Kind::ForStep;
+                    return false;
+                }
 
-            // Otherwise, currentPre is indeed a BinOp and will be included
-            // in this parsing round
-            auto currentOp = stream.currentToken.value;
+                // Check and consume THEN
+                if (type != Lexing::Type::Then) {
+                    throw getError("[{}:{}] Expected 'then' in for loop, found '{}'", stream);
+                }
+                stream.getNextToken();
+                frame.kind = Frame::Kind::ForBody;
+                return false;
 
-            // Consume the operator
-            stream.getNextToken();
+            case Frame::Kind::ForStep:
+                frame.clauses[2] = value;
 
-            // Parse the primary associated with this BinOp
-            auto rhs = parsePrimary();
-            if (!rhs) return nullptr;
-
-            // Same thing as the currentPre, get nextPre
-            auto nextPre = getOperatorPrecedence();
-            if (currentPre < nextPre) {
-                // In this case, rhs will be the new 'lhs' of the next BinOp
-                // As such, we will recursively get rhs until the BinOp followed it
-                // has lower precedence than currentPre
-                // The +1 is because we parse from left to right, so if two BinOps
-                // are the same, we parse the previous first
-                rhs = parseBinOpRHS(exprPre + 1, std::move(rhs));
-                if (!rhs) return nullptr;
+                // Check and consume THEN
+                if (type != Lexing::Type::Then) {
+                    throw getError("[{}:{}] Expected 'then' in for loop, found '{}'", stream);
+                }
+                stream.getNextToken();
+                frame.kind = Frame::Kind::ForBody;
+                return false;
+
+            case Frame::Kind::ForBody: {
+                auto expr = program->add(AST::ForExpr{frame.name, frame.clauses[0], frame.clauses[1],
+                                                      frame.clauses[2], value});
+                frames.pop_back();
+                operands.push_back(expr);
+                return true;
             }
 
-            // Now that we have both lhs and rhs and a BinOp to combine them
-            // we can combine them and continue parsing the rest of the expression
-            lhs = std::make_unique<AST::BinaryExpr>(std::move(lhs), currentOp, std::move(rhs));
+            case Frame::Kind::Root:
+                break;
         }
+        throw Utility::getError(Utility::FE, "Invalid parser frame");
     }
 
     ProtoPtr Parser::parseProto() {
         // Assert that current token is an ID
         if (stream.currentToken.type != Lexing::Type::Id) {
-            throw getError("[{}:{}] Expected name in prototype, found '{}'", stream.currentToken);
+            throw getError("[{}:{}] Expected name in prototype, found '{}'", stream);
         }
 
         // Get function type, i.e. the ID
-        auto func_name = stream.currentToken.value;
+        auto func_name = stream.currentToken.symbol;
+
+        // Consume ID
+        stream.getNextToken();
+        return parseParams(func_name);
+    }
 
-        // Consume ID and check for LPAREN
-        if (stream.getNextToken().type != Lexing::Type::Lparen) {
-            throw getError("[{}:{}] Expected '(', found '{}'", stream.currentToken);
+    ProtoPtr Parser::parseParams(Utility::Symbol func_name) {
+        // Check for LPAREN
+        if (stream.currentToken.type != Lexing::Type::Lparen) {
+            throw getError("[{}:{}] Expected '(', found '{}'", stream);
         }
 
         // Now parse ids
-        std::vector<std::string> ids;
+        llvm::SmallVector<Utility::Symbol, 8> ids;
 
         // Check for standalone id
         // ids := ID
         if (stream.getNextToken().type == Lexing::Type::Id) {
-            ids.push_back(stream.currentToken.value);
+            ids.push_back(stream.currentToken.symbol);
 
             // Now check for more COMMA ID pair
             while (stream.getNextToken().type == Lexing::Type::Comma) {
@@ -298,36 +329,58 @@ namespace Firestorm::Parsing {
 
                 // Check that an ID follows
                 if (stream.currentToken.type != Lexing::Type::Id) {
-                    throw getError("[{}:{}] Expected ID, found '{}'", stream.currentToken);
+                    throw getError("[{}:{}] Expected ID, found '{}'", stream);
                 }
 
                 // Add ID to list
-                ids.push_back(stream.currentToken.value);
+                ids.push_back(stream.currentToken.symbol);
             }
         }
 
         // At the end of argument lists, check for RPAREN
         if (stream.currentToken.type != Lexing::Type::Rparen) {
-            throw getError("[{}:{}] Expected ')', found '{}'", stream.currentToken);
+            throw getError("[{}:{}] Expected ')', found '{}'", stream);
         }
 
         // Now that everything is good to go, consume RPAREN
         stream.getNextToken();
-        return std::make_unique<AST::Prototype>(func_name, ids);
+        auto first = (std::uint32_t) program->parameters.size();
+        program->parameters.insert(program->parameters.end(), ids.begin(), ids.end());
+        return program->add(AST::Prototype{func_name, first, (std::uint32_t) ids.size()});
     }
 
     FunctionPtr Parser::parseDefineStmt() {
         // Consume DEFINE token
         stream.getNextToken();
 
-        // Parse proto
-        auto proto = parseProto();
-        if (!proto) return nullptr;
+        // Assert that current token is an ID
+        if (stream.currentToken.type != Lexing::Type::Id) {
+            throw getError("[{}:{}] Expected name in prototype, found '{}'", stream);
+        }
+
+        // Annotations come before the name, which is the last ID
+        std::uint8_t fastMath = 0;
+        bool memoize = false;
+        auto name = stream.currentToken;
+        while (stream.getNextToken().type == Lexing::Type::Id) {
+            if (name.value == "memo") {
+                memoize = true;
+            } else if (auto flags = AST::getFastMathFlags(name.value)) {
+                fastMath |= flags;
+            } else {
+                throw getError("[{}:{}] Unknown annotation '{}'", stream, name);
+            }
+            name = stream.currentToken;
+        }
+
+        // Parse the rest of proto
+        auto proto = parseParams(name.symbol);
+        if (!proto) return {};
 
         if (auto body = parseExpr()) {
-            return std::make_unique<AST::Function>(std::move(proto), std::move(body));
+            return program->add(AST::Function{proto, body, fastMath, memoize});
         }
-        return nullptr;
+        return {};
     }
 
     ProtoPtr Parser::parseExternStmt() {
@@ -343,7 +396,7 @@ namespace Firestorm::Parsing {
         } else if (stream.currentToken.type == Lexing::Type::Define) {
             return parseDefineStmt();
         } else {
-            throw getError("[{}:{}] Expected 'extern' or 'define', found '{}'", stream.currentToken);
+            throw getError("[{}:{}] Expected 'extern' or 'define', found '{}'", stream);
         }
     }
 
@@ -360,39 +413,45 @@ namespace Firestorm::Parsing {
         return parseOtrStmt();
     }
 
-    std::vector<ExprPtr> Parser::parseStmts() {
-        std::vector<ExprPtr> stmts;
-
+    void Parser::parseStmts(AST::Program &p) {
         // Keep looping to get all statement
-        auto stmt = parseStmt();
-        while (stmt) {
-            // Check semicolon
-            if (stream.currentToken.type != Lexing::Type::Semicolon) {
-                throw getError("[{}:{}] Expected ';' after statement, found '{}'", stream.currentToken);
-            }
-
-            // Add statement to stmts
-            stmts.push_back(std::move(stmt));
-
-            // Consume SEMICOLON and check for null token , i.e. end of source
-            if (stream.getNextToken().type == Lexing::Type::Eof) break;
-
-            // Get next statement (if any)
-            stmt = parseStmt();
+        while (auto stmt = parseNext(p)) {
+            p.statements.push_back(stmt);
         }
+    }
 
-        return stmts;
+    AST::Program Parser::parseProgram() {
+        AST::Program p;
+        parseStmts(p);
+        return p;
     }
 
-    std::vector<ExprPtr> Parser::parseProgram() {
-        return parseStmts();
+    AST::Program Parser::parse() {
+        return parseProgram();
     }
 
-    std::vector<ExprPtr> Parser::parse() {
+    ExprPtr Parser::parseNext(AST::Program &p) {
+        program = &p;
+
         // Get first token
-        stream.getNextToken();
-        // Check if source is empty, i.e. null token
+        if (!started) {
+            stream.getNextToken();
+            started = true;
+        }
+
+        // Check if end of source, i.e. null token
         if (stream.currentToken.type == Lexing::Type::Eof) return {};
-        return parseProgram();
+
+        auto stmt = parseStmt();
+        if (!stmt) return {};
+
+        // Check semicolon
+        if (stream.currentToken.type != Lexing::Type::Semicolon) {
+            throw getError("[{}:{}] Expected ';' after statement, found '{}'", stream);
+        }
+
+        // Consume SEMICOLON
+        stream.getNextToken();
+        return stmt;
     }
 }
@@ -0,0 +1,37 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/profile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace Firestorm::AST {
+    std::shared_ptr<const Profile> readProfile(const std::string &path) {
+        std::ifstream file(path);
+        if (!file) throw Utility::getError(Utility::FE, "Cannot open '{}'", path);
+
+        auto profile = std::make_shared<Profile>();
+        std::string line;
+        for (std::size_t number = 1; std::getline(file, line); ++number) {
+            std::istringstream fields(line);
+            std::string name;
+            std::size_t count = 0;
+            if (!(fields >> name >> count) || count == 0) {
+                throw Utility::getError(Utility::FE, "Invalid profile '{}' at line {}", path, number);
+            }
+
+            std::vector<std::uint64_t> counters(count);
+            for (auto &counter: counters) {
+                if (!(fields >> counter)) {
+                    throw Utility::getError(Utility::FE, "Invalid profile '{}' at line {}", path, number);
+                }
+            }
+            profile->maxCalls = std::max(profile->maxCalls, counters[0]);
+            profile->functions[name] = std::move(counters);
+        }
+        return profile;
+    }
+}
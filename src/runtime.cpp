@@ -0,0 +1,63 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/runtime.hpp"
+
+#include <cstdio>
+
+extern "C" {
+    double putd(double x) {
+        std::printf("%f\n", x);
+        return 0;
+    }
+
+    double putchard(double x) {
+        std::putchar((int) x);
+        return 0;
+    }
+}
+
+namespace {
+    /// @brief Statistics of memoized functions, the last registered first
+    FirestormMemoStats *memoStats = nullptr;
+
+    /// @brief Counters of instrumented functions, the last registered first
+    FirestormProfile *profiles = nullptr;
+}
+
+extern "C" {
+    void firestorm_register_memo(FirestormMemoStats *stats) {
+        stats->next = memoStats;
+        memoStats = stats;
+    }
+
+    void firestorm_print_memo_stats() {
+        for (auto stats = memoStats; stats; stats = stats->next) {
+            auto calls = stats->hits + stats->misses;
+            std::fprintf(stderr, "Memoization of '%s': %llu hits, %llu misses, %.1f%% hit rate\n", stats->name,
+                         (unsigned long long) stats->hits, (unsigned long long) stats->misses,
+                         calls ? 100.0 * (double) stats->hits / (double) calls : 0.0);
+        }
+    }
+
+    void firestorm_register_profile(FirestormProfile *profile) {
+        profile->next = profiles;
+        profiles = profile;
+    }
+
+    void firestorm_write_profile(const char *path) {
+        auto file = std::fopen(path, "w");
+        if (!file) {
+            std::fprintf(stderr, "Error: Cannot write profile '%s'\n", path);
+            return;
+        }
+        for (auto profile = profiles; profile; profile = profile->next) {
+            std::fprintf(file, "%s %llu", profile->name, (unsigned long long) profile->size);
+            for (std::uint64_t i = 0; i < profile->size; ++i) {
+                std::fprintf(file, " %llu", (unsigned long long) profile->counters[i]);
+            }
+            std::fputc('\n', file);
+        }
+        if (std::fclose(file) != 0) std::fprintf(stderr, "Error: Cannot write profile '%s'\n", path);
+    }
+}
@@ -0,0 +1,182 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/scan.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIRESTORM_HAS_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define FIRESTORM_HAS_X86_KERNELS 0
+#endif
+
+namespace Firestorm::Lexing {
+    namespace {
+        // I. Scalar kernels
+        // These also finish the tail shorter than a vector in the other kernels.
+        inline bool isWhitespace(unsigned char c) {
+            // ' ' or one of '\t', '\n', '\v', '\f', '\r'
+            return c == ' ' || (unsigned char) (c - '\t') < 5;
+        }
+
+        inline bool isDigit(unsigned char c) {
+            return (unsigned char) (c - '0') < 10;
+        }
+
+        inline bool isIdentifier(unsigned char c) {
+            return isDigit(c) || (unsigned char) ((c | 0x20) - 'a') < 26 || c == '_';
+        }
+
+        const char *skipWhitespacesScalar(const char *begin, const char *end) {
+            while (begin != end && isWhitespace(*begin)) ++begin;
+            return begin;
+        }
+
+        const char *skipIdentifierScalar(const char *begin, const char *end) {
+            while (begin != end && isIdentifier(*begin)) ++begin;
+            return begin;
+        }
+
+        const char *skipDigitsScalar(const char *begin, const char *end) {
+            while (begin != end && isDigit(*begin)) ++begin;
+            return begin;
+        }
+
+        std::size_t countNewlinesScalar(const char *begin, const char *end) {
+            std::size_t count = 0;
+            for (; begin != end; ++begin) count += *begin == '\n';
+            return count;
+        }
+
+        constexpr ScanKernels scalarKernels{
+                "scalar",
+                skipWhitespacesScalar,
+                skipIdentifierScalar,
+                skipDigitsScalar,
+                countNewlinesScalar,
+        };
+
+#if FIRESTORM_HAS_X86_KERNELS
+        // II. SSE2 kernels
+        // Unsigned "x < n" on bytes is done as "min(x, n - 1) == x".
+        inline __m128i inRange(__m128i v, char low, char count) {
+            auto shifted = _mm_sub_epi8(v, _mm_set1_epi8(low));
+            return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8((char) (count - 1))), shifted);
+        }
+
+        inline __m128i whitespaceMask(__m128i v) {
+            return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), inRange(v, '\t', 5));
+        }
+
+        inline __m128i digitMask(__m128i v) {
+            return inRange(v, '0', 10);
+        }
+
+        inline __m128i identifierMask(__m128i v) {
+            auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            auto alpha = inRange(lower, 'a', 26);
+            auto underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+            return _mm_or_si128(_mm_or_si128(alpha, underscore), digitMask(v));
+        }
+
+        template<__m128i (*Mask)(__m128i), bool (*Scalar)(unsigned char)>
+        const char *skipSSE2(const char *begin, const char *end) {
+            while (end - begin >= 16) {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                auto outside = ~(unsigned) _mm_movemask_epi8(Mask(v)) & 0xFFFFu;
+                if (outside) return begin + __builtin_ctz(outside);
+                begin += 16;
+            }
+            while (begin != end && Scalar(*begin)) ++begin;
+            return begin;
+        }
+
+        std::size_t countNewlinesSSE2(const char *begin, const char *end) {
+            std::size_t count = 0;
+            auto newline = _mm_set1_epi8('\n');
+            for (; end - begin >= 16; begin += 16) {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                count += __builtin_popcount((unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+            }
+            return count + countNewlinesScalar(begin, end);
+        }
+
+        constexpr ScanKernels sse2Kernels{
+                "sse2",
+                skipSSE2<whitespaceMask, isWhitespace>,
+                skipSSE2<identifierMask, isIdentifier>,
+                skipSSE2<digitMask, isDigit>,
+                countNewlinesSSE2,
+        };
+
+        // III. AVX2 kernels
+        // Compiled for AVX2 regardless of compiler flags, and only picked when the CPU supports it.
+#define FIRESTORM_AVX2 __attribute__((target("avx2")))
+
+        FIRESTORM_AVX2 inline __m256i inRange256(__m256i v, char low, char count) {
+            auto shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(low));
+            return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8((char) (count - 1))), shifted);
+        }
+
+        FIRESTORM_AVX2 inline __m256i whitespaceMask256(__m256i v) {
+            return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), inRange256(v, '\t', 5));
+        }
+
+        FIRESTORM_AVX2 inline __m256i digitMask256(__m256i v) {
+            return inRange256(v, '0', 10);
+        }
+
+        FIRESTORM_AVX2 inline __m256i identifierMask256(__m256i v) {
+            auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            auto alpha = inRange256(lower, 'a', 26);
+            auto underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+            return _mm256_or_si256(_mm256_or_si256(alpha, underscore), digitMask256(v));
+        }
+
+        template<__m256i (*Mask)(__m256i), __m128i (*Mask128)(__m128i), bool (*Scalar)(unsigned char)>
+        FIRESTORM_AVX2 const char *skipAVX2(const char *begin, const char *end) {
+            while (end - begin >= 32) {
+                auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                auto outside = ~(unsigned) _mm256_movemask_epi8(Mask(v));
+                if (outside) return begin + __builtin_ctz(outside);
+                begin += 32;
+            }
+            return skipSSE2<Mask128, Scalar>(begin, end);
+        }
+
+        FIRESTORM_AVX2 std::size_t countNewlinesAVX2(const char *begin, const char *end) {
+            std::size_t count = 0;
+            auto newline = _mm256_set1_epi8('\n');
+            for (; end - begin >= 32; begin += 32) {
+                auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                count += __builtin_popcount((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)));
+            }
+            return count + countNewlinesSSE2(begin, end);
+        }
+
+#undef FIRESTORM_AVX2
+
+        constexpr ScanKernels avx2Kernels{
+                "avx2",
+                skipAVX2<whitespaceMask256, whitespaceMask, isWhitespace>,
+                skipAVX2<identifierMask256, identifierMask, isIdentifier>,
+                skipAVX2<digitMask256, digitMask, isDigit>,
+                countNewlinesAVX2,
+        };
+#endif
+
+        const ScanKernels &detectScanKernels() {
+#if FIRESTORM_HAS_X86_KERNELS
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return avx2Kernels;
+            if (__builtin_cpu_supports("sse2")) return sse2Kernels;
+#endif
+            return scalarKernels;
+        }
+    }
+
+    const ScanKernels &getScanKernels() {
+        static const auto &kernels = detectScanKernels();
+        return kernels;
+    }
+}
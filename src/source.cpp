@@ -0,0 +1,159 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/source.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+#define FIRESTORM_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define FIRESTORM_HAS_MMAP 0
+#endif
+
+namespace Firestorm::Lexing {
+    namespace {
+        /// @brief Size of the first chunk that files of unknown size are read in, doubling with every chunk
+        constexpr std::size_t chunkSize = 64 * 1024;
+    }
+
+    Source Source::fromFile(const std::string &path) {
+        Source source;
+        source.name = path;
+
+#if FIRESTORM_HAS_MMAP
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw Utility::getError(Utility::FE, "Cannot open '{}': {}", path, std::strerror(errno));
+        }
+
+        // Only regular files can be mapped, anything else is read below
+        struct stat info{};
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            source.length = (std::size_t) info.st_size;
+
+            // Empty files cannot be mapped, but there is nothing to map anyway
+            if (source.length == 0) {
+                ::close(fd);
+                source.data = source.buffer.data();
+                return source;
+            }
+
+            auto address = ::mmap(nullptr, source.length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (address == MAP_FAILED) {
+                throw Utility::getError(Utility::FE, "Cannot map '{}': {}", path, std::strerror(errno));
+            }
+
+            // Source is scanned once from start to end
+            ::madvise(address, source.length, MADV_SEQUENTIAL);
+
+            source.data = static_cast<const char *>(address);
+            source.mapped = true;
+            return source;
+        }
+        ::close(fd);
+#endif
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw Utility::getError(Utility::FE, "Cannot open '{}': {}", path, std::strerror(errno));
+        }
+
+        // Characters are read into the buffer in place, in one read if the size is known, and in growing chunks
+        // otherwise, e.g. from pipes, so that the source is never held twice
+        std::size_t used = 0;
+        if (file.seekg(0, std::ios::end)) {
+            auto size = file.tellg();
+            if (size > 0) source.buffer.resize((std::size_t) size);
+            file.seekg(0, std::ios::beg);
+        }
+        file.clear();
+        while (file) {
+            if (used == source.buffer.size()) {
+                // A known size is usually right, in which case the buffer is already full
+                if (file.peek() == std::ifstream::traits_type::eof()) break;
+                source.buffer.resize(std::max(source.buffer.size() * 2, chunkSize));
+            }
+            file.read(source.buffer.data() + used, (std::streamsize) (source.buffer.size() - used));
+            used += (std::size_t) file.gcount();
+        }
+        if (file.bad()) {
+            throw Utility::getError(Utility::FE, "Cannot read '{}': {}", path, std::strerror(errno));
+        }
+        source.buffer.resize(used);
+        source.data = source.buffer.data();
+        source.length = source.buffer.length();
+        return source;
+    }
+
+    Source Source::fromString(std::string text, std::string n) {
+        Source source;
+        source.name = std::move(n);
+        source.buffer = std::move(text);
+        source.data = source.buffer.data();
+        source.length = source.buffer.length();
+        return source;
+    }
+
+    Source::Source(Source &&other) noexcept {
+        *this = std::move(other);
+    }
+
+    Source &Source::operator=(Source &&other) noexcept {
+        if (this == &other) return *this;
+        unmap();
+
+        name = std::move(other.name);
+        buffer = std::move(other.buffer);
+        length = other.length;
+        released = other.released;
+        mapped = other.mapped;
+
+        // Moving buffer may relocate its characters, e.g. with small strings
+        data = mapped ? other.data : buffer.data();
+
+        other.data = nullptr;
+        other.length = 0;
+        other.released = 0;
+        other.mapped = false;
+        return *this;
+    }
+
+    Source::~Source() {
+        unmap();
+    }
+
+    void Source::release(std::size_t offset) {
+#if FIRESTORM_HAS_MMAP
+        if (!mapped) return;
+
+        // Only whole pages can be dropped
+        static const auto page_size = (std::size_t) ::sysconf(_SC_PAGESIZE);
+        auto end = std::min(offset, length) / page_size * page_size;
+        if (end <= released) return;
+
+        // The mapping is read-only, so dropped pages are simply read again from the file if needed
+        ::madvise(const_cast<char *>(data) + released, end - released, MADV_DONTNEED);
+        released = end;
+#else
+        (void) offset;
+#endif
+    }
+
+    void Source::unmap() {
+#if FIRESTORM_HAS_MMAP
+        if (mapped) ::munmap(const_cast<char *>(data), length);
+#endif
+        mapped = false;
+    }
+}
@@ -0,0 +1,99 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/symbol.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Firestorm::Utility {
+    namespace {
+        /// @brief Global table backing internSymbol() and getSymbolName().
+        ///
+        /// Names are copied into fixed-size blocks that never move, so the views handed out stay valid.
+        class SymbolTable {
+            static constexpr std::size_t block_size = 64 * 1024;
+
+            std::shared_mutex mutex;
+            std::unordered_map<std::string_view, std::uint32_t> ids;
+            std::vector<std::string_view> names;
+            std::vector<std::unique_ptr<char[]>> blocks;
+            std::size_t block_used = block_size;
+
+            std::string_view store(std::string_view name) {
+                // Names longer than a block get a block of their own, which is full once they are copied
+                if (name.length() > block_size) {
+                    auto *copy = blocks.emplace_back(new char[name.length()]).get();
+                    std::copy(name.begin(), name.end(), copy);
+                    block_used = block_size;
+                    return {copy, name.length()};
+                }
+
+                // block_used never exceeds block_size, so the space left never wraps around
+                if (name.length() > block_size - block_used) {
+                    blocks.emplace_back(new char[block_size]);
+                    block_used = 0;
+                }
+                auto *copy = blocks.back().get() + block_used;
+                std::copy(name.begin(), name.end(), copy);
+                block_used += name.length();
+                return {copy, name.length()};
+            }
+
+        public:
+            SymbolTable() {
+                // Reserve the default symbol for the empty name
+                names.emplace_back();
+                ids.emplace(names.back(), 0);
+            }
+
+            std::uint32_t find(std::string_view name) {
+                std::shared_lock lock(mutex);
+                auto it = ids.find(name);
+                return it == ids.end() ? UINT32_MAX : it->second;
+            }
+
+            std::uint32_t add(std::string_view name) {
+                std::unique_lock lock(mutex);
+
+                // Another thread may have added it in the meantime
+                if (auto it = ids.find(name); it != ids.end()) return it->second;
+
+                if (names.size() == UINT32_MAX) {
+                    throw getError(FE, "Too many distinct identifiers");
+                }
+
+                auto id = (std::uint32_t) names.size();
+                names.push_back(store(name));
+                ids.emplace(names.back(), id);
+                return id;
+            }
+
+            std::string_view get(std::uint32_t id) {
+                std::shared_lock lock(mutex);
+                return names[id];
+            }
+        };
+
+        SymbolTable &getSymbolTable() {
+            static SymbolTable table;
+            return table;
+        }
+    }
+
+    Symbol internSymbol(std::string_view name) {
+        auto &table = getSymbolTable();
+        auto id = table.find(name);
+        if (id == UINT32_MAX) id = table.add(name);
+        return {id};
+    }
+
+    std::string_view getSymbolName(Symbol symbol) {
+        return getSymbolTable().get(symbol.id);
+    }
+}
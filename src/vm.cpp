@@ -0,0 +1,219 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/runtime.hpp"
+#include "Firestorm/vm.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <dlfcn.h>
+
+// Threaded dispatch jumps straight from one instruction to the next with computed goto, a GNU extension.
+// Otherwise, instructions are dispatched by a switch in a loop.
+#if defined(__GNUC__)
+#define FIRESTORM_THREADED_DISPATCH 1
+#else
+#define FIRESTORM_THREADED_DISPATCH 0
+#endif
+
+namespace Firestorm::Backend {
+    namespace {
+        /// @brief Registers of all frames are limited to 128 MiB, so that runaway recursion fails cleanly
+        constexpr std::size_t max_stack_size = std::size_t(1) << 24;
+
+        /// @brief Frames are limited to 4 Mi as well, since calls that pass no argument don't grow the registers
+        constexpr std::size_t max_frame_count = std::size_t(1) << 22;
+
+        /// @brief Conditions are true if they are neither 0 nor NaN, like 'fcmp one' in LLVM IR
+        bool isTrue(double value) {
+            return value < 0 || value > 0;
+        }
+
+        /// @return The native code of an extern, from the runtime or else from the process, or nullptr
+        void *lookupNative(const std::string &name) {
+            // The runtime is linked into this executable, but its symbols are not necessarily exported
+            if (name == "putd") return (void *) &putd;
+            if (name == "putchard") return (void *) &putchard;
+            return ::dlsym(RTLD_DEFAULT, name.c_str());
+        }
+    }
+
+    void VM::reserve(std::size_t size) {
+        if (size <= stack.size()) return;
+        if (size > max_stack_size) throw Utility::getError(Utility::BE, "Stack overflow");
+        stack.resize(std::max(size, stack.size() * 2));
+    }
+
+    double VM::callNative(BytecodeFunction &function, const double *args) {
+        if (!function.native) {
+            auto name = std::string(Utility::getSymbolName(function.name));
+            function.native = lookupNative(name);
+            if (!function.native) throw Utility::getError(Utility::BE, "Cannot find extern function '{}'", name);
+        }
+
+        using D = double;
+        auto native = function.native;
+        switch (function.arity) {
+            case 0:
+                return ((D (*)()) native)();
+            case 1:
+                return ((D (*)(D)) native)(args[0]);
+            case 2:
+                return ((D (*)(D, D)) native)(args[0], args[1]);
+            case 3:
+                return ((D (*)(D, D, D)) native)(args[0], args[1], args[2]);
+            case 4:
+                return ((D (*)(D, D, D, D)) native)(args[0], args[1], args[2], args[3]);
+            case 5:
+                return ((D (*)(D, D, D, D, D)) native)(args[0], args[1], args[2], args[3], args[4]);
+            case 6:
+                return ((D (*)(D, D, D, D, D, D)) native)(args[0], args[1], args[2], args[3], args[4], args[5]);
+            default:
+                throw Utility::getError(Utility::BE, "Extern function '{}' has more than 6 arguments",
+                                        Utility::getSymbolName(function.name));
+        }
+    }
+
+    double VM::run(const BytecodeFunction &function) {
+        frames.clear();
+        reserve(function.registerCount);
+
+        // State of the current frame
+        const BytecodeFunction *current = &function;
+        const Instruction *code = function.code.data();
+        const Instruction *ip = code;
+        const double *constants = function.constants.data();
+        std::size_t base = 0;
+        double *r = stack.data();
+        double result;
+
+#if FIRESTORM_THREADED_DISPATCH
+        static const void *labels[] = {
+#define FIRESTORM_LABEL(name) &&op_##name,
+                FIRESTORM_OPCODES(FIRESTORM_LABEL)
+#undef FIRESTORM_LABEL
+        };
+#define FIRESTORM_DISPATCH() goto *labels[(std::size_t) ip->op]
+#define FIRESTORM_OP(name) op_##name:
+        FIRESTORM_DISPATCH();
+#else
+#define FIRESTORM_DISPATCH() continue
+#define FIRESTORM_OP(name) case Opcode::name:
+        while (true) switch (ip->op) {
+#endif
+        FIRESTORM_OP(LoadConst) {
+            r[ip->a] = constants[ip->wide()];
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Move) {
+            r[ip->a] = r[ip->b];
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Add) {
+            r[ip->a] = r[ip->b] + r[ip->c];
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Sub) {
+            r[ip->a] = r[ip->b] - r[ip->c];
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Mul) {
+            r[ip->a] = r[ip->b] * r[ip->c];
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Div) {
+            r[ip->a] = r[ip->b] / r[ip->c];
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Equ) {
+            r[ip->a] = r[ip->b] == r[ip->c] ? 1.0 : 0.0;
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Lt) {
+            // Unordered, like 'fcmp ult' in LLVM IR
+            r[ip->a] = !(r[ip->b] >= r[ip->c]) ? 1.0 : 0.0;
+            ++ip;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Jump) {
+            ip = code + ip->wide();
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(JumpIfFalse) {
+            ip = isTrue(r[ip->a]) ? ip + 1 : code + ip->wide();
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(JumpIfTrue) {
+            ip = isTrue(r[ip->a]) ? code + ip->wide() : ip + 1;
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Call) {
+            auto &callee = module.functions[ip->wide()];
+            if (callee.code.empty()) {
+                r[ip->a] = callNative(callee, r + ip->a);
+                ++ip;
+                FIRESTORM_DISPATCH();
+            }
+
+            // The frame of the callee starts at its arguments
+            if (frames.size() >= max_frame_count) throw Utility::getError(Utility::BE, "Stack overflow");
+            frames.push_back({current, ip + 1, base});
+            base += ip->a;
+            reserve(base + callee.registerCount);
+            r = stack.data() + base;
+            current = &callee;
+            code = ip = callee.code.data();
+            constants = callee.constants.data();
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(TailCall) {
+            auto &callee = module.functions[ip->wide()];
+            if (callee.code.empty()) {
+                // Externs have no frame to reuse, so their value is returned right away
+                result = callNative(callee, r + ip->a);
+                goto return_result;
+            }
+
+            // The frame of the callee replaces that of the caller, starting at the arguments moved to its start
+            std::memmove(r, r + ip->a, callee.arity * sizeof(double));
+            reserve(base + callee.registerCount);
+            r = stack.data() + base;
+            current = &callee;
+            code = ip = callee.code.data();
+            constants = callee.constants.data();
+            FIRESTORM_DISPATCH();
+        }
+        FIRESTORM_OP(Return) {
+            result = r[ip->a];
+        return_result:
+            if (frames.empty()) return result;
+
+            // The caller finds the value where it put the arguments
+            r[0] = result;
+            auto &frame = frames.back();
+            current = frame.function;
+            code = current->code.data();
+            ip = frame.returnAddress;
+            constants = current->constants.data();
+            base = frame.base;
+            r = stack.data() + base;
+            frames.pop_back();
+            FIRESTORM_DISPATCH();
+        }
+#if !FIRESTORM_THREADED_DISPATCH
+        }
+#endif
+#undef FIRESTORM_DISPATCH
+#undef FIRESTORM_OP
+    }
+}
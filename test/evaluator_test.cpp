@@ -0,0 +1,55 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/ast.hpp"
+#include "Firestorm/ast_optimiser.hpp"
+#include "Firestorm/lexer.hpp"
+#include "Firestorm/parser.hpp"
+
+#include <iostream>
+#include <string>
+
+namespace {
+    int failures = 0;
+
+    void check(bool condition, const char *what) {
+        if (condition) return;
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+
+    /// @brief Optimises every statement of a source in order, as the front-end does.
+    ///
+    /// @return The last statement to compile
+    Firestorm::AST::ExprId optimiseAll(Firestorm::AST::Program &program, const std::string &source) {
+        Firestorm::Lexing::Lexer lexer;
+        auto stream = lexer.lex(source);
+        program = Firestorm::Parsing::Parser(stream).parse();
+
+        Firestorm::AST::ASTOptimiser optimiser(Firestorm::AST::OptimisationLevel::O2);
+        Firestorm::AST::ExprId last;
+        for (auto stmt: program.statements) last = optimiser.run(program, stmt);
+        return last;
+    }
+
+    bool isNumber(const Firestorm::AST::Program &program, Firestorm::AST::ExprId id, double value) {
+        return id && id.kind() == Firestorm::AST::ExprKind::Number &&
+               program.get<Firestorm::AST::NumberExpr>(id).value == value;
+    }
+}
+
+/// @brief Evaluates calls of pure functions whose callees are declared again, which keeps their first definition.
+int main() {
+    Firestorm::AST::Program program;
+
+    auto stmt = optimiseAll(program, "define f(x) x+1; define g(x) f(x)*2; extern f(x); g(3);");
+    check(isNumber(program, stmt, 8), "a callee named by a later extern keeps its definition");
+
+    stmt = optimiseAll(program, "define f(x) x+1; define g(x) f(x)*2; define f(x) 7; g(3);");
+    check(isNumber(program, stmt, 8), "a callee defined twice keeps its first definition");
+
+    stmt = optimiseAll(program, "extern f(x); define f(x) 7; f(3);");
+    check(stmt.kind() == Firestorm::AST::ExprKind::Call, "an extern defined later stays impure");
+
+    return failures == 0 ? 0 : 1;
+}
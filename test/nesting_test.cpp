@@ -0,0 +1,92 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/ast.hpp"
+#include "Firestorm/codegen.hpp"
+#include "Firestorm/custom_exceptions.hpp"
+#include "Firestorm/lexer.hpp"
+#include "Firestorm/parser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include <fmt/format.h>
+
+namespace {
+    /// @brief Lexes, parses, prints and generates the IR of a definition, without optimising it.
+    ///
+    /// @return Seconds it took
+    double compile(const std::string &input) {
+        auto start = std::chrono::steady_clock::now();
+        Firestorm::Lexing::Lexer lexer;
+        auto stream = lexer.lex(input);
+        auto program = Firestorm::Parsing::Parser(stream).parse();
+
+        Firestorm::AST::CodeGenerator codegen({Firestorm::AST::OptimisationLevel::O0});
+        for (auto stmt: program.statements) {
+            Firestorm::AST::toString(program, stmt);
+            Firestorm::AST::generateIR(codegen, program, stmt);
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::string repeat(const std::string &text, std::size_t count) {
+        std::string result;
+        result.reserve(text.size() * count);
+        for (std::size_t i = 0; i < count; ++i) result += text;
+        return result;
+    }
+
+    struct Shape {
+        const char *name;
+        std::size_t depth;
+        std::function<std::string(std::size_t)> generate;
+    };
+}
+
+/// @brief Compiles deeply nested definitions, which must neither overflow the stack nor take more than linear time.
+///
+/// @note Every shape is compiled at its depth and at a quarter of it. Linear time makes the ratio of the two about 4,
+/// quadratic time about 16, so more than 8 fails.
+int main() {
+    Shape shapes[] = {
+            {"nested parentheses", 100000, [](std::size_t n) {
+                return "define f(x) " + repeat("(", n) + "x" + repeat(")", n) + ";";
+            }},
+            {"chain of operands", 1000000, [](std::size_t n) {
+                return "define f(x) x" + repeat(" + x", n) + ";";
+            }},
+            {"nested if-expressions", 80000, [](std::size_t n) {
+                std::string input = "define f(x) ";
+                for (std::size_t i = 0; i < n; ++i) input += fmt::format("if x < {} then {} else ", i, i);
+                return input + "0;";
+            }},
+            {"nested calls", 100000, [](std::size_t n) {
+                return "define f(x) " + repeat("f(", n) + "x" + repeat(")", n) + ";";
+            }},
+    };
+
+    int failures = 0;
+    for (auto &shape: shapes) {
+        try {
+            auto small = compile(shape.generate(shape.depth / 4));
+            auto large = compile(shape.generate(shape.depth));
+            // Times too short to measure reliably pass
+            auto ratio = large / std::max(small, 0.01);
+            std::cout << fmt::format("{:<24} depth {:>8}: {:.3f} s, {:.3f} s at a quarter, ratio {:.1f}\n",
+                                     shape.name, shape.depth, large, small, ratio);
+            if (ratio > 8) {
+                std::cerr << fmt::format("FAILED: {} do not compile in linear time\n", shape.name);
+                ++failures;
+            }
+        } catch (const Firestorm::Utility::FirestormError &error) {
+            std::cerr << fmt::format("FAILED: {}: {}\n", shape.name, error.what());
+            ++failures;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
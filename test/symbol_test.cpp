@@ -0,0 +1,46 @@
+//
+// Created by Nguyen Thai Binh on 16/10/26.
+//
+#include "Firestorm/symbol.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void check(bool condition, const char *what) {
+        if (condition) return;
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+/// @brief Interns names longer than a block of the symbol table, between short ones, and checks that every name
+/// is kept intact and interned once.
+int main() {
+    using Firestorm::Utility::getSymbolName;
+    using Firestorm::Utility::internSymbol;
+
+    std::vector<std::string> names;
+    names.emplace_back(70000, 'a');
+    names.emplace_back("x0");
+    for (int i = 1; i < 2000; ++i) names.push_back("x" + std::to_string(i));
+    names.emplace_back(200000, 'b');
+    names.emplace_back("y0");
+    names.emplace_back(64 * 1024, 'c');
+    names.emplace_back("y1");
+
+    std::vector<Firestorm::Utility::Symbol> symbols;
+    for (auto &name: names) symbols.push_back(internSymbol(name));
+
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        check(getSymbolName(symbols[i]) == names[i], "names are kept intact");
+        check(internSymbol(names[i]) == symbols[i], "names are interned once");
+    }
+    check(internSymbol("") == Firestorm::Utility::Symbol{}, "the empty name is the default symbol");
+
+    if (failures == 0) std::cout << "All symbol tests passed\n";
+    return failures == 0 ? 0 : 1;
+}